@@ -86,6 +86,7 @@ static void init_particle_emitters(struct demo *demo)
 		demo->emitter[i]->particle_count = 60000;
 		demo->emitter[i]->particle_size = 2.0f;
 		demo->emitter[i]->new_particles_per_ms = 10000;
+		demo->emitter[i]->thread_count = g_get_num_processors();
 
 		/* Lifespan */
 		demo->emitter[i]->particle_lifespan.value = 2.0f;
@@ -0,0 +1,116 @@
+/*
+ *         test-compact.c -- Check the error bounds of compact swarm storage.
+ *
+ * Quantizes random particles into compact arrays (see swarm-compact.h) and
+ * checks that the values read back are within the documented bounds. Exits
+ * with a non-zero status if any are not.
+ */
+#include "config.h"
+
+#include "swarm-compact.h"
+
+#include <float.h>
+#include <math.h>
+#include <stdio.h>
+
+#define PARTICLE_COUNT 100000
+
+/* The size of the swarm, and the margin that the swarm adds around it when
+ * it creates it's compact arrays. */
+#define WIDTH 1024
+#define HEIGHT 768
+#define DEPTH 100
+#define MARGIN 0.25f
+
+/* The speed range of the random particles. */
+#define MAX_SPEED 100.0f
+
+/* Half precision floats lose precision below their smallest normal value. */
+#define HALF_MIN_NORMAL 6.103515625e-5f
+
+static int check(const char *name, float error, float bound)
+{
+	printf("%-8s largest error %g, bound %g\n", name, error, bound);
+
+	if (error <= bound)
+		return 0;
+
+	fprintf(stderr, "%s error %g exceeds %g\n", name, error, bound);
+	return 1;
+}
+
+int main(int argc, char **argv)
+{
+	struct swarm_arrays particles;
+	struct swarm_compact_arrays compact;
+	float size[3] = { WIDTH, HEIGHT, DEPTH }, min[3], max[3];
+	float position_error = 0, position_bound = 0;
+	float velocity_error = 0, size_error = 0;
+	GRand *rand = g_rand_new_with_seed(1);
+	int i, j, failures = 0;
+
+	for (j = 0; j < 3; j++) {
+		min[j] = -size[j] * MARGIN;
+		max[j] = size[j] * (1 + MARGIN);
+
+		/* 1/87,000 of the swarm's size, plus the rounding of the
+		 * largest coordinate to a float. */
+		position_bound = MAX(position_bound,
+				     size[j] / 87000 + max[j] * FLT_EPSILON);
+	}
+
+	swarm_arrays_init(&particles, PARTICLE_COUNT);
+	swarm_compact_arrays_init(&compact, PARTICLE_COUNT, min, max);
+
+	for (i = 0; i < PARTICLE_COUNT; i++) {
+		for (j = 0; j < 3; j++) {
+			particles.position[j][i] = g_rand_double_range(rand, min[j],
+								       max[j]);
+			particles.velocity[j][i] = g_rand_double_range(rand,
+								       -MAX_SPEED,
+								       MAX_SPEED);
+		}
+
+		particles.size[i] = g_rand_double_range(rand,
+							SWARM_MIN_PARTICLE_SIZE,
+							SWARM_MAX_PARTICLE_SIZE);
+
+		swarm_compact_arrays_set(&compact, i, &particles, i);
+	}
+
+	for (i = 0; i < PARTICLE_COUNT; i++) {
+		float position[3], velocity[3], particle_size;
+
+		swarm_compact_arrays_get(&compact, i, position, velocity,
+					 &particle_size);
+
+		for (j = 0; j < 3; j++) {
+			float v = particles.velocity[j][i];
+
+			position_error = MAX(position_error,
+					     fabsf(position[j] -
+						   particles.position[j][i]));
+
+			/* Relative to the velocity, or to the smallest normal
+			 * half for velocities which are smaller still. */
+			velocity_error = MAX(velocity_error,
+					     fabsf(velocity[j] - v) /
+					     MAX(fabsf(v), HALF_MIN_NORMAL));
+		}
+
+		size_error = MAX(size_error,
+				 fabsf(particle_size - particles.size[i]));
+	}
+
+	failures += check("position", position_error, position_bound);
+	failures += check("velocity", velocity_error, 1.0f / 2048);
+	failures += check("size", size_error,
+			  (SWARM_MAX_PARTICLE_SIZE - SWARM_MIN_PARTICLE_SIZE) /
+			  510 + SWARM_MAX_PARTICLE_SIZE * FLT_EPSILON);
+
+	swarm_compact_arrays_clear(&compact);
+	swarm_arrays_clear(&particles);
+	g_rand_free(rand);
+
+	return failures ? 1 : 0;
+}
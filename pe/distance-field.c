@@ -0,0 +1,96 @@
+#include "distance-field.h"
+
+#include <math.h>
+#include <string.h>
+
+struct distance_field *distance_field_new(const float *origin, float spacing,
+					  const int *dims,
+					  const float *values)
+{
+	struct distance_field *field = g_slice_new0(struct distance_field);
+	gsize count = (gsize)dims[0] * dims[1] * dims[2];
+	unsigned int i;
+
+	for (i = 0; i < 3; i++) {
+		field->origin[i] = origin[i];
+		field->dims[i] = dims[i];
+	}
+
+	field->spacing = spacing;
+	field->values = g_new(float, count);
+	memcpy(field->values, values, sizeof(float) * count);
+
+	return field;
+}
+
+void distance_field_free(struct distance_field *field)
+{
+	g_free(field->values);
+	g_slice_free(struct distance_field, field);
+}
+
+float distance_field_sample(const struct distance_field *field,
+			    const float *position, float *gradient)
+{
+	int c[3], stride[3], base = 0;
+	float t[3], v[8], a, b;
+	unsigned int i;
+
+	stride[0] = 1;
+	stride[1] = field->dims[0];
+	stride[2] = field->dims[0] * field->dims[1];
+
+	/* Find the cell containing the position, and the position within it. */
+	for (i = 0; i < 3; i++) {
+		float x = (position[i] - field->origin[i]) / field->spacing;
+
+		x = CLAMP(x, 0.0f, (float)(field->dims[i] - 1));
+		c[i] = MIN((int)x, MAX(field->dims[i] - 2, 0));
+		t[i] = x - c[i];
+
+		base += c[i] * stride[i];
+
+		/* A single point along an axis makes a cell of zero width. */
+		if (field->dims[i] < 2)
+			stride[i] = 0;
+	}
+
+	/* The values at the corners of the cell, indexed by the bits zyx. */
+	for (i = 0; i < 8; i++) {
+		v[i] = field->values[base + (i & 1) * stride[0] +
+				     ((i >> 1) & 1) * stride[1] +
+				     ((i >> 2) & 1) * stride[2]];
+	}
+
+	if (gradient) {
+		/* The partial derivatives of the interpolant along each axis
+		 * are the differences between opposing faces, interpolated
+		 * over the other two axes. */
+		a = (1 - t[1]) * (1 - t[2]) * (v[1] - v[0]) +
+			t[1] * (1 - t[2]) * (v[3] - v[2]) +
+			(1 - t[1]) * t[2] * (v[5] - v[4]) +
+			t[1] * t[2] * (v[7] - v[6]);
+		gradient[0] = a / field->spacing;
+
+		a = (1 - t[0]) * (1 - t[2]) * (v[2] - v[0]) +
+			t[0] * (1 - t[2]) * (v[3] - v[1]) +
+			(1 - t[0]) * t[2] * (v[6] - v[4]) +
+			t[0] * t[2] * (v[7] - v[5]);
+		gradient[1] = a / field->spacing;
+
+		a = (1 - t[0]) * (1 - t[1]) * (v[4] - v[0]) +
+			t[0] * (1 - t[1]) * (v[5] - v[1]) +
+			(1 - t[0]) * t[1] * (v[6] - v[2]) +
+			t[0] * t[1] * (v[7] - v[3]);
+		gradient[2] = a / field->spacing;
+	}
+
+	/* Interpolate along x, then y, then z. */
+	for (i = 0; i < 4; i++)
+		v[i] = v[i * 2] + (v[i * 2 + 1] - v[i * 2]) * t[0];
+
+	a = v[0] + (v[1] - v[0]) * t[1];
+	b = v[2] + (v[3] - v[2]) * t[1];
+
+	return a + (b - a) * t[2];
+}
@@ -0,0 +1,55 @@
+/*
+ *         distance-field.h -- Sampled signed distance fields.
+ *
+ * A signed distance field stores, at each point of a regular 3D grid, the
+ * distance from that point to the surface of the nearest obstacle. Points
+ * inside of an obstacle have a negative distance. Since the field is computed
+ * ahead of time, any amount of static geometry can be represented, and the
+ * cost of finding the distance to it is the same: a single trilinear sample.
+ *
+ * The gradient of the field points away from the nearest surface, so it can be
+ * used to steer around obstacles.
+ *
+ * The values are stored with x varying fastest, so that the value at grid
+ * point (x, y, z) is values[(z * dims[1] + y) * dims[0] + x], and lies at
+ * origin + (x, y, z) * spacing. Positions outside of the grid are clamped to
+ * it's edges.
+ */
+#ifndef _DISTANCE_FIELD_H_
+#define _DISTANCE_FIELD_H_
+
+#include <glib.h>
+
+struct distance_field {
+	/* The position of the first grid point. */
+	float origin[3];
+
+	/* The distance between adjacent grid points. */
+	float spacing;
+
+	/* The number of grid points along each axis. */
+	int dims[3];
+
+	/* The distance at each grid point. */
+	float *values;
+};
+
+/*
+ * Create a distance field from the given grid of values, which are copied.
+ * Every dimension must be at least 1.
+ */
+struct distance_field *distance_field_new(const float *origin, float spacing,
+					  const int *dims,
+					  const float *values);
+
+void distance_field_free(struct distance_field *field);
+
+/*
+ * Return the distance at the given position, by trilinear interpolation of the
+ * surrounding grid points. If gradient is not NULL, then the gradient of the
+ * interpolated field at the position is written to it.
+ */
+float distance_field_sample(const struct distance_field *field,
+			    const float *position, float *gradient);
+
+#endif /* _DISTANCE_FIELD_H_ */
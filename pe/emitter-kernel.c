@@ -0,0 +1,184 @@
+#include "emitter-kernel.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define HAVE_AVX2_KERNEL 1
+#include <immintrin.h>
+#endif
+
+/* The number of arrays: position, velocity, color and max_age. */
+#define ARRAY_COUNT 11
+
+typedef void (*update_func)(struct emitter_arrays *arrays, int start, int end,
+			    const int *tags, const float *accelerations,
+			    float tick_time);
+
+/*
+ * Return the stride between arrays of particle_count floats. Each array is
+ * padded to a whole number of vectors, so that every array starts on an
+ * aligned boundary.
+ */
+static size_t get_stride(int particle_count)
+{
+	return (MAX(particle_count, 1) + EMITTER_VECTOR_WIDTH - 1) /
+		EMITTER_VECTOR_WIDTH * EMITTER_VECTOR_WIDTH;
+}
+
+void emitter_arrays_init(struct emitter_arrays *arrays, int particle_count)
+{
+	size_t stride = get_stride(particle_count);
+	size_t size = sizeof(float) * stride * ARRAY_COUNT;
+	void *data;
+	int i;
+
+	if (posix_memalign(&data, EMITTER_ALIGNMENT, size))
+		g_error(G_STRLOC " failed to allocate particle arrays");
+
+	memset(data, 0, size);
+
+	arrays->data = data;
+	arrays->capacity = particle_count;
+
+	for (i = 0; i < 3; i++) {
+		arrays->position[i] = arrays->data + stride * i;
+		arrays->velocity[i] = arrays->data + stride * (3 + i);
+	}
+
+	for (i = 0; i < 4; i++)
+		arrays->color[i] = arrays->data + stride * (6 + i);
+
+	arrays->max_age = arrays->data + stride * 10;
+}
+
+void emitter_arrays_clear(struct emitter_arrays *arrays)
+{
+	free(arrays->data);
+	memset(arrays, 0, sizeof(*arrays));
+}
+
+void emitter_arrays_move(struct emitter_arrays *arrays, int from, int to)
+{
+	int i;
+
+	for (i = 0; i < 3; i++) {
+		arrays->position[i][to] = arrays->position[i][from];
+		arrays->velocity[i][to] = arrays->velocity[i][from];
+	}
+
+	for (i = 0; i < 4; i++)
+		arrays->color[i][to] = arrays->color[i][from];
+
+	arrays->max_age[to] = arrays->max_age[from];
+}
+
+static void update_scalar(struct emitter_arrays *arrays, int start, int end,
+			  const int *tags, const float *accelerations,
+			  float tick_time)
+{
+	const float *acceleration = accelerations;
+	float t;
+	int i, j;
+
+	for (i = start; i < end; i++) {
+		if (tags)
+			acceleration = &accelerations[tags[i] * 3];
+
+		for (j = 0; j < 3; j++) {
+			arrays->velocity[j][i] += acceleration[j] * tick_time;
+			arrays->position[j][i] += arrays->velocity[j][i];
+		}
+
+		/* Fade color over time */
+		t = tick_time / arrays->max_age[i];
+
+		for (j = 0; j < 4; j++)
+			arrays->color[j][i] -= t;
+	}
+}
+
+#ifdef HAVE_AVX2_KERNEL
+
+__attribute__((target("avx2")))
+static void update_avx2(struct emitter_arrays *arrays, int start, int end,
+			const int *tags, const float *accelerations,
+			float tick_time)
+{
+	const __m256 dt = _mm256_set1_ps(tick_time);
+	__m256i offsets;
+	__m256 dv[3], v, t;
+	int i, j;
+
+	for (j = 0; j < 3; j++)
+		dv[j] = _mm256_mul_ps(_mm256_set1_ps(accelerations[j]), dt);
+
+	/* Update single particles until the arrays are aligned. */
+	i = MIN(end, (start + EMITTER_VECTOR_WIDTH - 1) /
+		EMITTER_VECTOR_WIDTH * EMITTER_VECTOR_WIDTH);
+	update_scalar(arrays, start, i, tags, accelerations, tick_time);
+
+	for ( ; i + EMITTER_VECTOR_WIDTH <= end; i += EMITTER_VECTOR_WIDTH) {
+		/* Gather the acceleration of each particle's emitter */
+		if (tags) {
+			offsets = _mm256_loadu_si256((const __m256i *)&tags[i]);
+			offsets = _mm256_mullo_epi32(offsets,
+						     _mm256_set1_epi32(3));
+
+			for (j = 0; j < 3; j++)
+				dv[j] = _mm256_mul_ps(_mm256_i32gather_ps(accelerations + j,
+									  offsets, 4),
+						      dt);
+		}
+
+		for (j = 0; j < 3; j++) {
+			v = _mm256_add_ps(_mm256_load_ps(&arrays->velocity[j][i]),
+					  dv[j]);
+			_mm256_store_ps(&arrays->velocity[j][i], v);
+			_mm256_store_ps(&arrays->position[j][i],
+					_mm256_add_ps(_mm256_load_ps(&arrays->position[j][i]),
+						      v));
+		}
+
+		t = _mm256_div_ps(dt, _mm256_load_ps(&arrays->max_age[i]));
+
+		for (j = 0; j < 4; j++)
+			_mm256_store_ps(&arrays->color[j][i],
+					_mm256_sub_ps(_mm256_load_ps(&arrays->color[j][i]),
+						      t));
+	}
+
+	/* Finish off any particles which don't fill a vector. */
+	update_scalar(arrays, i, end, tags, accelerations, tick_time);
+}
+
+#endif /* HAVE_AVX2_KERNEL */
+
+static update_func update;
+
+static void select_kernels(void)
+{
+	static gsize initialised;
+
+	if (!g_once_init_enter(&initialised))
+		return;
+
+	update = update_scalar;
+
+#ifdef HAVE_AVX2_KERNEL
+	__builtin_cpu_init();
+
+	if (__builtin_cpu_supports("avx2"))
+		update = update_avx2;
+#endif
+
+	g_once_init_leave(&initialised, 1);
+}
+
+void emitter_kernel_update(struct emitter_arrays *arrays, int start, int end,
+			   const int *tags, const float *accelerations,
+			   float tick_time)
+{
+	select_kernels();
+	update(arrays, start, end, tags, accelerations, tick_time);
+}
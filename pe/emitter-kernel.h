@@ -0,0 +1,75 @@
+/*
+ *         emitter-kernel.h -- Particle emitter update kernel.
+ *
+ * Every live particle of an emitter is moved, aged and faded every tick, and
+ * for large emitters this loop is most of the cost of a frame. The emitter
+ * keeps it's particle state in a structure of arrays, where each component of
+ * each property has an array of it's own, so that the kernel can update many
+ * particles at once using SIMD instructions.
+ *
+ * On x86 processors which support AVX2, the kernel updates 8 particles at a
+ * time. Otherwise it falls back to a scalar implementation. The choice is made
+ * at runtime, so the same library works on any processor.
+ */
+#ifndef _EMITTER_KERNEL_H_
+#define _EMITTER_KERNEL_H_
+
+#include <glib.h>
+
+/* The alignment (in bytes) of particle arrays. */
+#define EMITTER_ALIGNMENT 32
+
+/* The number of floats in a SIMD vector. Particle arrays are padded to a
+ * multiple of this length. */
+#define EMITTER_VECTOR_WIDTH 8
+
+/*
+ * Particle state in structure of arrays form.
+ */
+struct emitter_arrays {
+	float *position[3];
+	float *velocity[3];
+
+	/* The red, green, blue and alpha of each particle. */
+	float *color[4];
+
+	/* The lifespan of each particle, in seconds. Particles fade out
+	 * linearly over their lifespan. */
+	float *max_age;
+
+	/* The number of particles that the arrays can hold. */
+	int capacity;
+
+	/* The storage that the arrays point into. */
+	float *data;
+};
+
+/*
+ * Allocate storage for particle_count particles, with every value zeroed.
+ */
+void emitter_arrays_init(struct emitter_arrays *arrays, int particle_count);
+
+/*
+ * Free the storage of a set of particle arrays.
+ */
+void emitter_arrays_clear(struct emitter_arrays *arrays);
+
+/*
+ * Copy the state of the particle at index from over the particle at index to.
+ */
+void emitter_arrays_move(struct emitter_arrays *arrays, int from, int to);
+
+/*
+ * Update the particles in the range [start, end) for a tick of tick_time
+ * seconds: accelerate them (v = u + at), move them by their new velocity, and
+ * fade their color by the fraction of their lifespan that has passed.
+ *
+ * The acceleration of particle i is the 3 floats at accelerations + tags[i] *
+ * 3, so that particles from several emitters can be updated together. If tags
+ * is NULL, then every particle has the first acceleration.
+ */
+void emitter_kernel_update(struct emitter_arrays *arrays, int start, int end,
+			   const int *tags, const float *accelerations,
+			   float tick_time);
+
+#endif /* _EMITTER_KERNEL_H_ */
@@ -0,0 +1,86 @@
+#include "morton.h"
+
+#include <string.h>
+
+/* The number of bits sorted per radix sort pass. */
+#define RADIX_BITS 10
+#define RADIX_SIZE (1 << RADIX_BITS)
+
+/*
+ * Spread the lower 10 bits of x out so that there are two zero bits between
+ * each of them.
+ */
+static guint32 spread_bits(guint32 x)
+{
+	x &= 0x3ff;
+	x = (x | (x << 16)) & 0x030000ff;
+	x = (x | (x << 8)) & 0x0300f00f;
+	x = (x | (x << 4)) & 0x030c30c3;
+	x = (x | (x << 2)) & 0x09249249;
+
+	return x;
+}
+
+guint32 morton_encode(const float *position, const float *min,
+		      const float *size)
+{
+	const float scale = (1 << MORTON_BITS) - 1;
+	guint32 code = 0;
+	unsigned int i;
+
+	for (i = 0; i < 3; i++) {
+		float x = size[i] > 0 ? (position[i] - min[i]) / size[i] : 0;
+
+		code |= spread_bits((guint32)(CLAMP(x, 0.0f, 1.0f) * scale)) << i;
+	}
+
+	return code;
+}
+
+void morton_sort(guint32 *codes, int *indices, int count,
+		 guint32 *scratch_codes, int *scratch_indices)
+{
+	guint32 *src_codes = codes, *dst_codes = scratch_codes, *tmp_codes;
+	int *src_indices = indices, *dst_indices = scratch_indices, *tmp_indices;
+	int offsets[RADIX_SIZE];
+	int i, shift;
+
+	for (shift = 0; shift < MORTON_BITS * 3; shift += RADIX_BITS) {
+		int sum = 0;
+
+		/* Count the occupancy of each bucket */
+		memset(offsets, 0, sizeof(offsets));
+		for (i = 0; i < count; i++)
+			offsets[(src_codes[i] >> shift) & (RADIX_SIZE - 1)]++;
+
+		/* Convert the counts into bucket offsets */
+		for (i = 0; i < RADIX_SIZE; i++) {
+			int n = offsets[i];
+
+			offsets[i] = sum;
+			sum += n;
+		}
+
+		/* Scatter into the buckets */
+		for (i = 0; i < count; i++) {
+			int j = offsets[(src_codes[i] >> shift) & (RADIX_SIZE - 1)]++;
+
+			dst_codes[j] = src_codes[i];
+			dst_indices[j] = src_indices[i];
+		}
+
+		tmp_codes = src_codes;
+		src_codes = dst_codes;
+		dst_codes = tmp_codes;
+
+		tmp_indices = src_indices;
+		src_indices = dst_indices;
+		dst_indices = tmp_indices;
+	}
+
+	/* An odd number of passes leaves the result in the scratch arrays. */
+	if (src_codes != codes) {
+		memcpy(codes, src_codes, sizeof(guint32) * count);
+		memcpy(indices, src_indices, sizeof(int) * count);
+	}
+}
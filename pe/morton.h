@@ -0,0 +1,37 @@
+/*
+ *         morton.h -- Z-order (Morton) codes for 3D positions.
+ *
+ * A Morton code interleaves the bits of the quantised x, y and z coordinates of
+ * a position into a single integer. Sorting positions by their Morton codes
+ * orders them along a Z-order curve, which keeps positions that are close in
+ * space close in the sorted order. Every aligned cube of 8^n cells occupies a
+ * contiguous range of codes, which makes the codes convenient for building
+ * octrees.
+ *
+ * Coordinates are quantised to MORTON_BITS bits per axis.
+ */
+#ifndef _MORTON_H_
+#define _MORTON_H_
+
+#include <glib.h>
+
+/* The number of bits per axis, and the number of levels of an octree that can
+ * be derived from a code. */
+#define MORTON_BITS 10
+
+/*
+ * Return the Morton code of a position within the bounding box [min, min +
+ * size]. Positions outside of the box are clamped to it.
+ */
+guint32 morton_encode(const float *position, const float *min,
+		      const float *size);
+
+/*
+ * Sort count indices by their codes, using a stable radix sort. On return, the
+ * codes and indices arrays are both in sorted order. The scratch arrays must
+ * each have room for count elements.
+ */
+void morton_sort(guint32 *codes, int *indices, int count,
+		 guint32 *scratch_codes, int *scratch_indices);
+
+#endif /* _MORTON_H_ */
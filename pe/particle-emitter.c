@@ -1,67 +1,232 @@
 #include "particle-emitter.h"
 
+#include "emitter-kernel.h"
 #include "particle-engine.h"
+#include "timing-wheel.h"
+#include "worker-pool.h"
 
 #include <cogl/cogl.h>
 #include <math.h>
+#include <stdlib.h>
 #include <string.h>
 
-struct particle {
-	/* Whether the particle is active or not. */
-	CoglBool active;
+/* The cell size of the index used for spatial queries. */
+#define QUERY_CELL_SIZE 32
 
-	/* Particle velocity */
-	float velocity[3];
+/* The number of slots in the expiry wheel, and the interval (in seconds)
+ * covered by each, which together span the lifespan of most particles. */
+#define EXPIRY_SLOTS 1024
+#define EXPIRY_RESOLUTION 0.01
 
-	/* The maximum age of this particle in seconds. The particle will linearly
-	 * fade out until this age */
-	gdouble max_age;
+/* The number of live particles below which particles are updated serially,
+ * if the emitter doesn't give a threshold. */
+#define PARALLEL_THRESHOLD 8192
 
-	/* Time to live. This value represents the age of the particle. When it
-	 * reaches zero, the particle ist destroyed. */
-	gdouble ttl;
+/* The number of particles handed to a worker at a time. This is a multiple of
+ * EMITTER_VECTOR_WIDTH, so that every chunk starts on an aligned boundary. */
+#define UPDATE_CHUNK_SIZE 4096
+
+/*
+ * The particles of one or more emitters, and the vertices that they are drawn
+ * with. An emitter on it's own has a pool of it's own, while the emitters in a
+ * group all spawn into the group's pool, which is mapped, updated and drawn
+ * once per frame for them all.
+ */
+struct emitter_pool {
+	/* The number of particles that the pool can hold. */
+	int particle_count;
+
+	gdouble current_time;
+	gdouble last_update_time;
+
+	/* The live particles are packed at the start of the array, in the
+	 * range [0, live_count), as are their vertices, and only they are
+	 * mapped and drawn. New particles are appended, and expired particles
+	 * are replaced by the last live particle. The vertices are written
+	 * from the particles at the end of each tick. */
+	struct emitter_arrays particles;
+	int live_count;
+
+	/* The emitters which spawn into the pool, and the emitter that each
+	 * particle belongs to, as an index into emitters. Pools with a single
+	 * emitter have no tags. */
+	struct particle_emitter **emitters;
+	int emitter_count;
+	int *tags;
+
+	/* The acceleration of each emitter, copied at the start of each tick,
+	 * so that the kernel can look them up by tag. */
+	float *accelerations;
+
+	/* The length of the current tick, and the number of live particles
+	 * that it moves, which excludes the particles created by the tick. */
+	float tick_time;
+	int update_count;
+
+	/* The workers used to update particles, and the thread count that they
+	 * were created with. */
+	struct worker_pool *workers;
+	int thread_count;
+
+	/* The time at which each live particle expires, and scratch space for
+	 * the particles which expire in a tick. */
+	struct timing_wheel *expiry;
+	int *expired;
+
+	/* The index used for spatial queries, which is created by the first
+	 * query and updated every tick from then on. Only pools with a single
+	 * emitter are queried. */
+	struct particle_index *index;
+
+	struct particle_engine *engine;
 };
 
 struct particle_emitter_priv {
 	GTimer *timer;
-	gdouble current_time;
-	gdouble last_update_time;
 
-	struct particle *particles;
+	/* The number of the emitter's particles which are alive. */
 	int active_particles_count;
 
 	GRand *rand;
 
+	/* The pool which holds the emitter's particles, which is either it's
+	 * own or that of it's group. */
+	struct emitter_pool *pool;
+	struct particle_emitter_group *group;
+
+	/* The thread creating the resources of a prepared emitter, until it
+	 * is joined by the first paint (see particle_emitter_prepare()). */
+	GThread *prepare_thread;
+
 	CoglContext *ctx;
 	CoglFramebuffer *fb;
-	struct particle_engine *engine;
 };
 
-static void create_resources(struct particle_emitter *emitter)
+struct particle_emitter_group_priv {
+	GTimer *timer;
+
+	/* The emitters in the group. */
+	struct particle_emitter **emitters;
+	int emitter_count;
+
+	CoglContext *ctx;
+	CoglFramebuffer *fb;
+	struct emitter_pool *pool;
+};
+
+/*
+ * Create a pool of particle_count particles for the given emitters, and the
+ * engine which holds the vertices until the render thread realizes it. This
+ * can be run on any thread.
+ */
+static struct emitter_pool *pool_new(struct particle_emitter **emitters,
+				     int emitter_count, int particle_count,
+				     float particle_size)
+{
+	struct emitter_pool *pool = g_slice_new0(struct emitter_pool);
+	int i;
+
+	pool->particle_count = particle_count;
+
+	emitter_arrays_init(&pool->particles, particle_count);
+
+	pool->emitters = g_new(struct particle_emitter *, MAX(emitter_count, 1));
+	memcpy(pool->emitters, emitters, sizeof(*emitters) * emitter_count);
+	pool->emitter_count = emitter_count;
+	pool->accelerations = g_new0(float, MAX(emitter_count, 1) * 3);
+
+	if (emitter_count > 1)
+		pool->tags = g_new0(int, MAX(particle_count, 1));
+
+	for (i = 0; i < emitter_count; i++)
+		emitters[i]->priv->active_particles_count = 0;
+
+	pool->expiry = timing_wheel_new(particle_count, EXPIRY_SLOTS,
+					EXPIRY_RESOLUTION);
+	pool->expired = g_new(int, MAX(particle_count, 1));
+
+	pool->engine = particle_engine_new_deferred(particle_count,
+						    particle_size);
+	particle_engine_set_draw_count(pool->engine, 0);
+
+	return pool;
+}
+
+static void pool_free(struct emitter_pool *pool)
+{
+	if (pool->engine)
+		particle_engine_free(pool->engine);
+
+	emitter_arrays_clear(&pool->particles);
+
+	g_free(pool->emitters);
+	g_free(pool->tags);
+	g_free(pool->accelerations);
+
+	if (pool->workers)
+		worker_pool_free(pool->workers);
+	g_free(pool->expired);
+
+	if (pool->expiry)
+		timing_wheel_free(pool->expiry);
+
+	if (pool->index)
+		particle_index_free(pool->index);
+
+	g_slice_free(struct emitter_pool, pool);
+}
+
+static void create_state(struct particle_emitter *emitter)
+{
+	emitter->priv->pool = pool_new(&emitter, 1, emitter->particle_count,
+				       emitter->particle_size);
+}
+
+static gpointer prepare_thread_main(gpointer data)
+{
+	create_state(data);
+
+	return NULL;
+}
+
+/*
+ * Wait for the thread preparing the emitter, if there is one.
+ */
+static void join_prepare_thread(struct particle_emitter *emitter)
 {
 	struct particle_emitter_priv *priv = emitter->priv;
 
-	priv->active_particles_count = 0;
+	if (priv->prepare_thread) {
+		g_thread_join(priv->prepare_thread);
+		priv->prepare_thread = NULL;
+	}
+}
 
-	priv->particles = g_new0(struct particle, emitter->particle_count);
+static void create_resources(struct particle_emitter *emitter)
+{
+	struct particle_emitter_priv *priv = emitter->priv;
 
-	priv->engine = particle_engine_new(priv->ctx, priv->fb,
-					   emitter->particle_count,
-					   emitter->particle_size);
+	if (priv->prepare_thread)
+		join_prepare_thread(emitter);
+	else
+		create_state(emitter);
+
+	/* Only uploading the vertices needs the render thread. */
+	particle_engine_realize(priv->pool->engine, priv->ctx, priv->fb);
 }
 
-static void create_particle(struct particle_emitter *emitter,
+/*
+ * Create a particle of the emitter with the given tag at index in it's pool.
+ */
+static void create_particle(struct emitter_pool *pool,
+			    struct particle_emitter *emitter, int tag,
 			    int index)
 {
-	struct particle_emitter_priv *priv = emitter->priv;
-	struct particle *particle = &priv->particles[index];
-	float *position, initial_speed, mag;
-	CoglColor *color;
+	struct emitter_arrays *particles = &pool->particles;
+	float position[3], velocity[3], initial_speed, mag;
+	CoglColor color;
 	unsigned int i;
 
-	position = particle_engine_get_particle_position(priv->engine, index);
-	color = particle_engine_get_particle_color(priv->engine, index);
-
 	/* Get position */
 	fuzzy_vector_get_real_value(&emitter->particle_position,
 				    emitter->priv->rand, position);
@@ -71,144 +236,218 @@ static void create_particle(struct particle_emitter *emitter,
 
 	/* Get direction */
 	fuzzy_vector_get_real_value(&emitter->particle_direction,
-				    emitter->priv->rand,
-				    &particle->velocity[0]);
+				    emitter->priv->rand, velocity);
 
 	/* Get direction unit vector magnitude */
-	mag = sqrt((particle->velocity[0] * particle->velocity[0]) +
-		   (particle->velocity[1] * particle->velocity[1]) +
-		   (particle->velocity[2] * particle->velocity[2]));
+	mag = sqrt((velocity[0] * velocity[0]) +
+		   (velocity[1] * velocity[1]) +
+		   (velocity[2] * velocity[2]));
 
 	/* Scale velocity from unit vector */
-	for (i = 0; i < 3; i++)
-		particle->velocity[i] *= initial_speed / mag;
+	for (i = 0; i < 3; i++) {
+		particles->position[i][index] = position[i];
+		particles->velocity[i][index] = velocity[i] * initial_speed / mag;
+	}
 
 	/* Set initial color */
 	fuzzy_color_get_cogl_color(&emitter->particle_color,
-				   emitter->priv->rand, color);
+				   emitter->priv->rand, &color);
+
+	particles->color[0][index] = cogl_color_get_red(&color);
+	particles->color[1][index] = cogl_color_get_green(&color);
+	particles->color[2][index] = cogl_color_get_blue(&color);
+	particles->color[3][index] = cogl_color_get_alpha(&color);
+
+	particles->max_age[index] = fuzzy_double_get_real_value(&emitter->particle_lifespan,
+								emitter->priv->rand);
+
+	if (pool->tags)
+		pool->tags[index] = tag;
 
-	particle->max_age = fuzzy_double_get_real_value(&emitter->particle_lifespan,
-							emitter->priv->rand);
-	particle->ttl = particle->max_age;
-	particle->active = TRUE;
+	/* The particle is destroyed by the first tick after it has lived for
+	 * max_age. */
+	timing_wheel_insert(pool->expiry, index,
+			    pool->current_time + particles->max_age[index]);
+
+	if (pool->index)
+		particle_index_update(pool->index, index, position);
 }
 
-static void destroy_particle(struct particle_emitter *emitter,
-			     int index)
+/*
+ * Destroy a particle which has expired, and move the last live particle into
+ * it's place, so that the live particles stay packed.
+ */
+static void destroy_particle(struct emitter_pool *pool, int index)
 {
-	struct particle_emitter_priv *priv = emitter->priv;
-	struct particle *particle = &priv->particles[index];
-	float *position = particle_engine_get_particle_position(priv->engine,
-								index);
-	CoglColor *color = particle_engine_get_particle_color(priv->engine,
-							      index);
+	int last = --pool->live_count;
+	int tag = pool->tags ? pool->tags[index] : 0;
+
+	pool->emitters[tag]->priv->active_particles_count--;
 
-	particle->active = FALSE;
+	if (index != last) {
+		emitter_arrays_move(&pool->particles, last, index);
+		timing_wheel_move(pool->expiry, last, index);
+
+		if (pool->tags)
+			pool->tags[index] = pool->tags[last];
+	}
 
-	/* Zero the particle */
-	memset(position, 0, sizeof(float) * 3);
-	cogl_color_init_from_4f(color, 0, 0, 0, 0);
+	if (pool->index)
+		particle_index_remove(pool->index, last);
 }
 
-static void update_particle(struct particle_emitter *emitter,
-			    int index,
-			    gdouble tick_time)
+static int compare_indices_descending(const void *a, const void *b)
 {
-	struct particle_emitter_priv *priv = emitter->priv;
-	struct particle *particle = &priv->particles[index];
-	float *position = particle_engine_get_particle_position(priv->engine,
-								index);
-	CoglColor *color = particle_engine_get_particle_color(priv->engine,
-							      index);
-	float t, r, g, b, a;
-	unsigned int i;
+	return *(const int *)b - *(const int *)a;
+}
 
-	/* Update position, using v = u + at */
-	for (i = 0; i < 3; i++) {
-		particle->velocity[i] += emitter->acceleration[i] * tick_time;
-		position[i] += particle->velocity[i];
+/*
+ * Move the particles in the range [start, end) to their current positions in
+ * the query index.
+ */
+static void update_index(struct emitter_pool *pool, int start, int end)
+{
+	const struct emitter_arrays *particles = &pool->particles;
+	float position[3];
+	int i, j;
+
+	for (i = start; i < end; i++) {
+		for (j = 0; j < 3; j++)
+			position[j] = particles->position[j][i];
+
+		particle_index_update(pool->index, i, position);
 	}
+}
+
+/*
+ * Move the particles in the range [start, end) which are being updated, and
+ * write the vertices of every particle in the range. Workers only touch their
+ * own range of particles, so any number may run concurrently.
+ */
+static void update_chunk(gpointer data, int start, int end, int worker)
+{
+	struct emitter_pool *pool = data;
+
+	(void)worker;
 
-	/* Fade color over time */
-	t = tick_time / particle->max_age;
-	r = cogl_color_get_red(color) - t;
-	g = cogl_color_get_green(color) - t;
-	b = cogl_color_get_blue(color) - t;
-	a = cogl_color_get_alpha(color) - t;
+	emitter_kernel_update(&pool->particles, start,
+			      MIN(end, pool->update_count), pool->tags,
+			      pool->accelerations, pool->tick_time);
 
-	cogl_color_init_from_4f(color, r, g, b, a);
+	particle_engine_write_particles(pool->engine, start, end,
+					pool->particles.position,
+					pool->particles.color);
 }
 
-static void tick(struct particle_emitter *emitter)
+/*
+ * Update every live particle, sharing them between the workers if there are
+ * enough of them.
+ */
+static void update_particles(struct emitter_pool *pool, int thread_count,
+			     int parallel_threshold)
 {
-	struct particle_emitter_priv *priv = emitter->priv;
-	struct particle_engine *engine = priv->engine;
-	int i, updated_particles = 0, destroyed_particles = 0;
-	int new_particles = 0, max_new_particles;
-	gdouble tick_time;
+	int count = pool->live_count;
+	int threshold = parallel_threshold > 0 ?
+		parallel_threshold : PARALLEL_THRESHOLD;
 
-	/* Create resources as necessary */
-	if (!engine)
-		create_resources(emitter);
+	thread_count = MAX(thread_count, 1);
+
+	if (thread_count == 1 || count < threshold) {
+		update_chunk(pool, 0, count, 0);
+		return;
+	}
+
+	/* Create new workers if the thread count has changed */
+	if (!pool->workers || pool->thread_count != thread_count) {
+		if (pool->workers)
+			worker_pool_free(pool->workers);
+
+		pool->workers = worker_pool_new(thread_count);
+		pool->thread_count = thread_count;
+	}
+
+	worker_pool_run_chunks(pool->workers, count, UPDATE_CHUNK_SIZE,
+			       update_chunk, pool);
+}
+
+/*
+ * Advance the pool to the given time: expire particles, create new particles
+ * for each of it's emitters, and update the particles and their vertices with
+ * a single mapping of the vertex buffer.
+ */
+static void tick(struct emitter_pool *pool, gdouble time, int thread_count,
+		 int parallel_threshold)
+{
+	struct particle_emitter *emitter;
+	int i, j, expired_count, new_particles;
+	gdouble tick_time;
 
 	/* Update the clocks */
-	priv->last_update_time = priv->current_time;
-	priv->current_time = g_timer_elapsed(priv->timer, NULL);
+	pool->last_update_time = pool->current_time;
+	pool->current_time = time;
 
-	tick_time = priv->current_time - priv->last_update_time;
+	tick_time = pool->current_time - pool->last_update_time;
 
-	/* The maximum number of new particles to create for this tick. This can
-	 * be zero, for example in the case where the emitter isn't active.
+	/* Remove the particles which had expired by the last tick. Removing
+	 * them from the highest index down means that the last live particle,
+	 * which takes the place of each, has never expired itself.
 	 */
-	max_new_particles = emitter->active ?
-		tick_time * emitter->new_particles_per_ms : 0;
+	expired_count = timing_wheel_expire(pool->expiry,
+					    pool->last_update_time,
+					    pool->expired);
 
-	/* We must first map the particle engine's buffer before reading or
-	 * writing particle data.
-	 */
-	particle_engine_push_buffer(priv->engine,
-				    COGL_BUFFER_ACCESS_READ_WRITE, 0);
+	qsort(pool->expired, expired_count, sizeof(int),
+	      compare_indices_descending);
+
+	for (i = 0; i < expired_count; i++)
+		destroy_particle(pool, pool->expired[i]);
 
-	/* Iterate over every particle and update/destroy/create as
-	 * necessary.
+	/* Append the new particles. Creating and destroying particles is
+	 * done serially, so the count of live particles is always exact, and
+	 * the new particles aren't moved until the next tick.
 	 */
-	for (i = 0; i < emitter->particle_count; i++) {
-		struct particle *particle = &priv->particles[i];
-
-		/* Break early if there's nothing left to do */
-		if (updated_particles >= priv->active_particles_count &&
-		    new_particles >= max_new_particles) {
-			break;
-		}
-
-		if (particle->active) {
-			if (particle->ttl > 0) {
-				/* Update the particle's position and color */
-				update_particle(emitter, i, tick_time);
-
-				/* Age the particle */
-				particle->ttl -= tick_time;
-			} else {
-				/* If a particle has expired, remove it */
-				destroy_particle(emitter, i);
-				destroyed_particles++;
-			}
-
-			updated_particles++;
-		} else if (new_particles < max_new_particles) {
-			/* Create a particle */
-			create_particle(emitter, i);
-			new_particles++;
-		}
+	pool->tick_time = tick_time;
+	pool->update_count = pool->live_count;
+
+	for (i = 0; i < pool->emitter_count; i++) {
+		emitter = pool->emitters[i];
+
+		for (j = 0; j < 3; j++)
+			pool->accelerations[i * 3 + j] = emitter->acceleration[j];
+
+		/* The maximum number of new particles to create for this
+		 * tick. This can be zero, for example in the case where the
+		 * emitter isn't active, or where the emitter or the pool is
+		 * full.
+		 */
+		new_particles = emitter->active ?
+			tick_time * emitter->new_particles_per_ms : 0;
+		new_particles = MIN(new_particles, emitter->particle_count -
+				    emitter->priv->active_particles_count);
+		new_particles = MIN(new_particles, pool->particle_count -
+				    pool->live_count);
+
+		for (j = 0; j < new_particles; j++)
+			create_particle(pool, emitter, i, pool->live_count++);
+
+		emitter->priv->active_particles_count += MAX(new_particles, 0);
 	}
 
-	/* We can safely unmap the changes we have made to the particle buffer
-	 * now.
+	/* Update the position and color of the live particles, and write out
+	 * their vertices. Every one is rewritten, so the old contents of the
+	 * buffer can be discarded.
 	 */
-	particle_engine_pop_buffer(priv->engine);
+	particle_engine_push_buffer_range(pool->engine, pool->live_count,
+					  COGL_BUFFER_ACCESS_WRITE,
+					  COGL_BUFFER_MAP_HINT_DISCARD_RANGE);
+	update_particles(pool, thread_count, parallel_threshold);
+	particle_engine_pop_buffer(pool->engine);
 
-	/* Update particle count */
-	priv->active_particles_count += new_particles - destroyed_particles;
+	particle_engine_set_draw_count(pool->engine, pool->live_count);
+
+	/* The index isn't safe to update concurrently */
+	if (pool->index)
+		update_index(pool, 0, pool->update_count);
 }
 
 struct particle_emitter* particle_emitter_new(CoglContext *ctx,
@@ -234,20 +473,201 @@ void particle_emitter_free(struct particle_emitter *emitter)
 {
 	struct particle_emitter_priv *priv = emitter->priv;
 
+	join_prepare_thread(emitter);
+
 	cogl_object_unref(priv->ctx);
 	cogl_object_unref(priv->fb);
 
 	g_rand_free(priv->rand);
 	g_timer_destroy(priv->timer);
 
-	particle_engine_free(priv->engine);
+	/* The pool of a grouped emitter belongs to the group. */
+	if (priv->pool && !priv->group)
+		pool_free(priv->pool);
 
 	g_slice_free(struct particle_emitter_priv, priv);
 	g_slice_free(struct particle_emitter, emitter);
 }
 
+void particle_emitter_prepare(struct particle_emitter *emitter)
+{
+	struct particle_emitter_priv *priv = emitter->priv;
+
+	if (priv->prepare_thread || priv->pool || priv->group)
+		return;
+
+	priv->prepare_thread = g_thread_new("particle-emitter-prepare",
+					    prepare_thread_main, emitter);
+}
+
 void particle_emitter_paint(struct particle_emitter *emitter)
 {
-	tick(emitter);
-	particle_engine_paint(emitter->priv->engine);
+	struct particle_emitter_priv *priv = emitter->priv;
+
+	g_return_if_fail(priv->group == NULL);
+
+	/* Create resources as necessary */
+	if (priv->prepare_thread || !priv->pool)
+		create_resources(emitter);
+
+	tick(priv->pool, g_timer_elapsed(priv->timer, NULL),
+	     emitter->thread_count, emitter->parallel_threshold);
+	particle_engine_paint(priv->pool->engine);
+}
+
+/*
+ * Return the emitter's query index, creating it if necessary, or NULL if the
+ * emitter has no particles yet, or is in a group.
+ */
+static struct particle_index *get_index(struct particle_emitter *emitter)
+{
+	struct particle_emitter_priv *priv = emitter->priv;
+	struct emitter_pool *pool = priv->pool;
+
+	if (priv->prepare_thread || !pool || priv->group)
+		return NULL;
+
+	if (!pool->index) {
+		pool->index = particle_index_new(pool->particle_count,
+						 QUERY_CELL_SIZE);
+		update_index(pool, 0, pool->live_count);
+	}
+
+	return pool->index;
+}
+
+int particle_emitter_query_radius(struct particle_emitter *emitter,
+				  const float *position, float radius,
+				  int *results, int max_results)
+{
+	struct particle_index *index = get_index(emitter);
+
+	return index ? particle_index_find_radius(index, position, radius,
+						  results, max_results) : 0;
+}
+
+int particle_emitter_query_nearest(struct particle_emitter *emitter,
+				   const float *position, int k, int *results)
+{
+	struct particle_index *index = get_index(emitter);
+
+	return index ? particle_index_find_nearest(index, position, k,
+						   results) : 0;
+}
+
+int particle_emitter_query_ray(struct particle_emitter *emitter,
+			       const float *origin, const float *direction,
+			       float radius, float max_distance,
+			       float *distance)
+{
+	struct particle_index *index = get_index(emitter);
+
+	return index ? particle_index_find_ray(index, origin, direction,
+					       radius, max_distance,
+					       distance) : -1;
+}
+
+void particle_emitter_query_batch(struct particle_emitter *emitter,
+				  struct particle_query *queries, int count)
+{
+	struct particle_index *index = get_index(emitter);
+	int i;
+
+	if (!index) {
+		for (i = 0; i < count; i++)
+			queries[i].result_count = 0;
+		return;
+	}
+
+	particle_index_query_batch(index, queries, count, NULL);
+}
+
+struct particle_emitter_group *particle_emitter_group_new(CoglContext *ctx,
+							  CoglFramebuffer *fb)
+{
+	struct particle_emitter_group *group =
+		g_slice_new0(struct particle_emitter_group);
+	struct particle_emitter_group_priv *priv =
+		g_slice_new0(struct particle_emitter_group_priv);
+
+	priv->ctx = cogl_object_ref(ctx);
+	priv->fb = cogl_object_ref(fb);
+
+	priv->timer = g_timer_new();
+
+	group->priv = priv;
+
+	return group;
+}
+
+void particle_emitter_group_free(struct particle_emitter_group *group)
+{
+	struct particle_emitter_group_priv *priv = group->priv;
+	int i;
+
+	for (i = 0; i < priv->emitter_count; i++)
+		particle_emitter_free(priv->emitters[i]);
+	g_free(priv->emitters);
+
+	cogl_object_unref(priv->ctx);
+	cogl_object_unref(priv->fb);
+
+	g_timer_destroy(priv->timer);
+
+	if (priv->pool)
+		pool_free(priv->pool);
+
+	g_slice_free(struct particle_emitter_group_priv, priv);
+	g_slice_free(struct particle_emitter_group, group);
+}
+
+void particle_emitter_group_add(struct particle_emitter_group *group,
+				struct particle_emitter *emitter)
+{
+	struct particle_emitter_group_priv *priv = group->priv;
+
+	g_return_if_fail(priv->pool == NULL);
+	g_return_if_fail(emitter->priv->pool == NULL);
+	g_return_if_fail(emitter->priv->prepare_thread == NULL);
+	g_return_if_fail(emitter->priv->group == NULL);
+
+	priv->emitters = g_renew(struct particle_emitter *, priv->emitters,
+				 priv->emitter_count + 1);
+	priv->emitters[priv->emitter_count++] = emitter;
+
+	emitter->priv->group = group;
+}
+
+static void create_group_resources(struct particle_emitter_group *group)
+{
+	struct particle_emitter_group_priv *priv = group->priv;
+	int i, particle_count = group->particle_count;
+
+	/* Without a limit, there is room for every emitter to be full at
+	 * once. */
+	if (particle_count <= 0) {
+		for (i = 0, particle_count = 0; i < priv->emitter_count; i++)
+			particle_count += priv->emitters[i]->particle_count;
+	}
+
+	priv->pool = pool_new(priv->emitters, priv->emitter_count,
+			      particle_count, group->particle_size);
+
+	for (i = 0; i < priv->emitter_count; i++)
+		priv->emitters[i]->priv->pool = priv->pool;
+
+	particle_engine_realize(priv->pool->engine, priv->ctx, priv->fb);
+}
+
+void particle_emitter_group_paint(struct particle_emitter_group *group)
+{
+	struct particle_emitter_group_priv *priv = group->priv;
+
+	/* Create resources as necessary */
+	if (priv->pool == NULL)
+		create_group_resources(group);
+
+	tick(priv->pool, g_timer_elapsed(priv->timer, NULL),
+	     group->thread_count, group->parallel_threshold);
+	particle_engine_paint(priv->pool->engine);
 }
@@ -2,6 +2,7 @@
 #define _PARTICLE_EMITTER_H_
 
 #include "fuzzy.h"
+#include "particle-index.h"
 
 #include <cogl/cogl.h>
 
@@ -23,7 +24,8 @@ struct particle_emitter {
 	 * The maximum number of particles that can exist at any given moment in
 	 * time. When this number of particles has been generated, then new
 	 * particles will only be created as and when old particles are
-	 * destroyed.
+	 * destroyed. Emitters in a group are also limited by the room left in
+	 * the group's pool.
 	 */
 	int particle_count;
 
@@ -34,7 +36,8 @@ struct particle_emitter {
 
 	/*
 	 * The size (in pixels) of particles. Each particle is represented by a
-	 * rectangular point of dimensions particle_size × particle_size.
+	 * rectangular point of dimensions particle_size × particle_size. Not
+	 * used by emitters in a group.
 	 */
 	float particle_size;
 
@@ -72,6 +75,22 @@ struct particle_emitter {
 	 */
 	float acceleration[3];
 
+	/*
+	 * The number of threads used to update particles. The live particles
+	 * are split into chunks which are shared between the threads, and the
+	 * calling thread always takes part. If zero or one, then the particles
+	 * are updated serially on the calling thread.
+	 */
+	int thread_count;
+
+	/*
+	 * The number of live particles below which they are updated serially
+	 * whatever the thread_count, as sharing out a small emitter's
+	 * particles costs more than it saves. If zero, then a default of 8192
+	 * is used.
+	 */
+	int parallel_threshold;
+
 	/* <priv> */
 	struct particle_emitter_priv *priv;
 };
@@ -80,6 +99,94 @@ struct particle_emitter *particle_emitter_new(CoglContext *ctx, CoglFramebuffer
 
 void particle_emitter_free(struct particle_emitter *emitter);
 
+/*
+ * Start allocating the emitter's particles and vertices on a background
+ * thread, so that the first paint only has to upload the vertices. The
+ * emitter's particle_count and particle_size must be set first, and must not
+ * be changed afterwards. Emitters which are not prepared are created by their
+ * first paint, as before.
+ */
+void particle_emitter_prepare(struct particle_emitter *emitter);
+
 void particle_emitter_paint(struct particle_emitter *emitter);
 
+/*
+ * Spatial queries over the live particles of the emitter, which return
+ * particle indices (see particle-index.h). Queries see the particles as of the
+ * last paint, and the indices are only valid until the next paint, as the live
+ * particles are kept packed together. The emitter's index is created by the
+ * first query, and then kept up to date as particles move, are created and
+ * expire. Before the emitter's first paint, and for emitters in a group,
+ * queries find no particles.
+ */
+int particle_emitter_query_radius(struct particle_emitter *emitter,
+				  const float *position, float radius,
+				  int *results, int max_results);
+
+int particle_emitter_query_nearest(struct particle_emitter *emitter,
+				   const float *position, int k, int *results);
+
+int particle_emitter_query_ray(struct particle_emitter *emitter,
+			       const float *origin, const float *direction,
+			       float radius, float max_distance,
+			       float *distance);
+
+void particle_emitter_query_batch(struct particle_emitter *emitter,
+				  struct particle_query *queries, int count);
+
+/* <priv> */
+struct particle_emitter_group_priv;
+
+/*
+ * A group of particle emitters which spawn into a single shared pool of
+ * particles, and are updated and drawn together.
+ *
+ * Each emitter in the group is configured through it's own fields, as though
+ * it were on it's own, but every particle is stored in the group's pool and
+ * tagged with the emitter that created it. A paint maps the vertex buffer
+ * once and draws every emitter's particles with a single draw call. Emitters
+ * which are rarely all busy at once, such as fireworks, need only share a
+ * pool large enough for their combined peak, rather than each holding room
+ * for it's own.
+ */
+struct particle_emitter_group {
+	/* The number of particles that the pool can hold. When the pool is
+	 * full, new particles are only created as old ones expire, with the
+	 * emitters added first served first. If zero, then the pool has room
+	 * for the particle_count of every emitter at once. */
+	int particle_count;
+
+	/* The size (in pixels) of particles. Every particle in the group is
+	 * drawn at the same size. */
+	float particle_size;
+
+	/* The number of threads used to update particles, and the number of
+	 * live particles below which they are updated serially, as for a
+	 * single emitter. The thread_count and parallel_threshold of the
+	 * emitters themselves are not used. */
+	int thread_count;
+	int parallel_threshold;
+
+	/* <priv> */
+	struct particle_emitter_group_priv *priv;
+};
+
+struct particle_emitter_group *particle_emitter_group_new(CoglContext *ctx,
+							  CoglFramebuffer *fb);
+
+/*
+ * Free the group, along with every emitter in it.
+ */
+void particle_emitter_group_free(struct particle_emitter_group *group);
+
+/*
+ * Add an emitter to the group, which takes ownership of it. Emitters must be
+ * added before the group is first painted, and must not be prepared or painted
+ * themselves.
+ */
+void particle_emitter_group_add(struct particle_emitter_group *group,
+				struct particle_emitter *emitter);
+
+void particle_emitter_group_paint(struct particle_emitter_group *group);
+
 #endif /* _PARTICLE_EMITTER_H_ */
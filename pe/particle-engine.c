@@ -9,8 +9,10 @@ struct particle_engine {
 
 	struct vertex *vertices;
 
-	/* The number of particles in the engine. */
+	/* The number of particles in the engine, and the number drawn
+	 * (starting from the first). */
 	int particle_count;
+	int draw_count;
 
 	/* The size (in pixels) of particles. Each particle is represented by a
 	 * rectangular point of dimensions particle_size × particle_size. */
@@ -22,25 +24,32 @@ struct vertex {
 	CoglColor color;
 };
 
-struct particle_engine *particle_engine_new(CoglContext *ctx,
-					    CoglFramebuffer *fb,
-					    int particle_count,
-					    float particle_size)
+struct particle_engine *particle_engine_new_deferred(int particle_count,
+						     float particle_size)
 {
 	struct particle_engine *engine;
-	CoglAttribute *attributes[2];
-	unsigned int i;
 
 	engine = g_slice_new0(struct particle_engine);
 
 	engine->particle_count = particle_count;
+	engine->draw_count = particle_count;
 	engine->particle_size = particle_size;
 
+	engine->vertices = g_new0(struct vertex, engine->particle_count);
+
+	return engine;
+}
+
+void particle_engine_realize(struct particle_engine *engine,
+			     CoglContext *ctx, CoglFramebuffer *fb)
+{
+	CoglAttribute *attributes[2];
+	unsigned int i;
+
 	engine->ctx = cogl_object_ref(ctx);
 	engine->fb = cogl_object_ref(fb);
 
 	engine->pipeline = cogl_pipeline_new(engine->ctx);
-	engine->vertices = g_new0(struct vertex, engine->particle_count);
 
 	engine->attribute_buffer =
 		cogl_attribute_buffer_new(engine->ctx,
@@ -68,24 +77,47 @@ struct particle_engine *particle_engine_new(CoglContext *ctx,
 						   G_N_ELEMENTS(attributes));
 
 	cogl_pipeline_set_point_size(engine->pipeline, engine->particle_size);
-	cogl_primitive_set_n_vertices(engine->primitive, engine->particle_count);
+	cogl_primitive_set_n_vertices(engine->primitive, engine->draw_count);
 
 	for (i = 0; i < G_N_ELEMENTS(attributes); i++)
 		cogl_object_unref(attributes[i]);
 
+	/* The attribute buffer has a copy of the initial vertices. From now
+	 * on, vertices points into the mapped buffer. */
+	g_free(engine->vertices);
+	engine->vertices = NULL;
+}
+
+struct particle_engine *particle_engine_new(CoglContext *ctx,
+					    CoglFramebuffer *fb,
+					    int particle_count,
+					    float particle_size)
+{
+	struct particle_engine *engine;
+
+	engine = particle_engine_new_deferred(particle_count, particle_size);
+	particle_engine_realize(engine, ctx, fb);
+
 	return engine;
 }
 
 void particle_engine_free(struct particle_engine *engine)
 {
+	/* A deferred engine which was never realized only has it's
+	 * vertices. */
+	if (!engine->primitive) {
+		g_free(engine->vertices);
+		g_slice_free(struct particle_engine, engine);
+		return;
+	}
+
 	cogl_object_unref(engine->ctx);
 	cogl_object_unref(engine->fb);
 	cogl_object_unref(engine->pipeline);
 	cogl_object_unref(engine->primitive);
 	cogl_object_unref(engine->attribute_buffer);
 
-	g_free(engine->vertices);
-	g_free(engine);
+	g_slice_free(struct particle_engine, engine);
 }
 
 inline void particle_engine_push_buffer(struct particle_engine *engine,
@@ -103,6 +135,25 @@ inline void particle_engine_push_buffer(struct particle_engine *engine,
 	}
 }
 
+void particle_engine_push_buffer_range(struct particle_engine *engine,
+				       int count, CoglBufferAccess access,
+				       CoglBufferMapHint hints)
+{
+	CoglError *error = NULL;
+
+	/* Cogl can't map an empty range */
+	count = CLAMP(count, 1, engine->particle_count);
+
+	engine->vertices = cogl_buffer_map_range(COGL_BUFFER(engine->attribute_buffer),
+						 0, sizeof(struct vertex) * count,
+						 access, hints, &error);
+
+	if (error != NULL) {
+		g_error(G_STRLOC " failed to map buffer: %s", error->message);
+		return;
+	}
+}
+
 inline void particle_engine_pop_buffer(struct particle_engine *engine)
 {
 	cogl_buffer_unmap(COGL_BUFFER(engine->attribute_buffer));
@@ -120,6 +171,36 @@ inline CoglColor *particle_engine_get_particle_color(struct particle_engine *eng
 	return &engine->vertices[index].color;
 }
 
+void particle_engine_write_particles(struct particle_engine *engine,
+				     int start, int end,
+				     float *const *position,
+				     float *const *color)
+{
+	struct vertex *vertex;
+	int i;
+
+	for (i = start; i < end; i++) {
+		vertex = &engine->vertices[i];
+
+		vertex->position[0] = position[0][i];
+		vertex->position[1] = position[1][i];
+		vertex->position[2] = position[2][i];
+
+		cogl_color_init_from_4f(&vertex->color, color[0][i], color[1][i],
+					color[2][i], color[3][i]);
+	}
+}
+
+void particle_engine_set_draw_count(struct particle_engine *engine,
+				    int count)
+{
+	engine->draw_count = CLAMP(count, 0, engine->particle_count);
+
+	if (engine->primitive)
+		cogl_primitive_set_n_vertices(engine->primitive,
+					      engine->draw_count);
+}
+
 void particle_engine_paint(struct particle_engine *engine)
 {
 	cogl_primitive_draw(engine->primitive,
@@ -16,6 +16,25 @@ struct particle_engine *particle_engine_new(CoglContext *ctx,
 					    int particle_count,
 					    float particle_size);
 
+/*
+ * Create a particle engine whose vertices are kept in ordinary memory until
+ * particle_engine_realize() uploads them. Until then, the vertices can be
+ * written on any thread through particle_engine_get_particle_position() and
+ * particle_engine_get_particle_color(), without mapping the buffer, and they
+ * start zeroed. This lets a frontend create it's initial particles off of the
+ * render thread.
+ */
+struct particle_engine *particle_engine_new_deferred(int particle_count,
+						     float particle_size);
+
+/*
+ * Create the Cogl resources of a deferred engine, and upload it's vertices.
+ * This must be called on the render thread, before the engine is mapped or
+ * painted.
+ */
+void particle_engine_realize(struct particle_engine *engine,
+			     CoglContext *ctx, CoglFramebuffer *fb);
+
 /*
  * Destroy a particle engine and free associated resources.
  */
@@ -29,6 +48,15 @@ inline void particle_engine_push_buffer(struct particle_engine *engine,
 					CoglBufferAccess access,
 					CoglBufferMapHint hints);
 
+/*
+ * This maps the vertices of only the first count particles, so that only they
+ * are read back or written out. Vertices outside of the range must not be
+ * touched until the buffer is popped.
+ */
+void particle_engine_push_buffer_range(struct particle_engine *engine,
+				       int count, CoglBufferAccess access,
+				       CoglBufferMapHint hints);
+
 /*
  * This unmaps the internal attribute buffer, writing out any changes made to
  * the particle vertices.
@@ -45,6 +73,24 @@ inline float *particle_engine_get_particle_position(struct particle_engine *engi
  */
 inline CoglColor *particle_engine_get_particle_color(struct particle_engine *engine, int index);
 
+/*
+ * Write the vertices of the particles in the range [start, end) from positions
+ * and colors in structure of arrays form, where position[0][i] is the x
+ * coordinate of particle i, and color[3][i] it's alpha. The buffer must be
+ * mapped.
+ */
+void particle_engine_write_particles(struct particle_engine *engine,
+				     int start, int end,
+				     float *const *position,
+				     float *const *color);
+
+/*
+ * Draw only the first count particles, rather than every particle. This lets
+ * a frontend which keeps it's live particles packed together skip the rest.
+ */
+void particle_engine_set_draw_count(struct particle_engine *engine,
+				    int count);
+
 /*
  * Paint function.
  */
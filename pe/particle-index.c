@@ -0,0 +1,474 @@
+#include "particle-index.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* The number of buckets per particle. */
+#define BUCKETS_PER_PARTICLE 2
+
+/* Searches which would visit more than this many cells per particle in the
+ * index visit every particle instead. */
+#define MAX_CELLS_PER_PARTICLE 4
+
+/* The number of queries handed to a worker at a time. */
+#define QUERY_CHUNK_SIZE 16
+
+/* Cell coordinates are clamped to this range, so that distant particles do
+ * not overflow. */
+#define MAX_COORD (1 << 28)
+
+struct particle_index *particle_index_new(int particle_count, float cell_size)
+{
+	struct particle_index *index = g_slice_new0(struct particle_index);
+	int i;
+
+	index->cell_size = cell_size;
+	index->inv_cell_size = 1.0f / cell_size;
+
+	index->bucket_count = 1;
+	while (index->bucket_count < particle_count * BUCKETS_PER_PARTICLE)
+		index->bucket_count <<= 1;
+
+	index->bucket_head = g_new(int, index->bucket_count);
+	for (i = 0; i < index->bucket_count; i++)
+		index->bucket_head[i] = -1;
+
+	index->particle_count = particle_count;
+	index->positions = g_new0(float, MAX(particle_count, 1) * 3);
+	index->cells = g_new0(int, MAX(particle_count, 1) * 3);
+	index->bucket = g_new(int, MAX(particle_count, 1));
+	index->next = g_new(int, MAX(particle_count, 1));
+	index->prev = g_new(int, MAX(particle_count, 1));
+
+	for (i = 0; i < particle_count; i++)
+		index->bucket[i] = -1;
+
+	return index;
+}
+
+void particle_index_free(struct particle_index *index)
+{
+	g_free(index->bucket_head);
+	g_free(index->positions);
+	g_free(index->cells);
+	g_free(index->bucket);
+	g_free(index->next);
+	g_free(index->prev);
+
+	g_slice_free(struct particle_index, index);
+}
+
+static inline int get_coord(const struct particle_index *index, float x)
+{
+	float c = floorf(x * index->inv_cell_size);
+
+	return (int)CLAMP(c, -MAX_COORD, MAX_COORD);
+}
+
+static inline int get_bucket(const struct particle_index *index,
+			     int x, int y, int z)
+{
+	guint h = (guint)x * 73856093u ^ (guint)y * 19349663u ^
+		(guint)z * 83492791u;
+
+	return h & (index->bucket_count - 1);
+}
+
+/*
+ * Return whether a particle is in the cell at the given coordinates, as
+ * particles from several cells may share a bucket.
+ */
+static inline gboolean in_cell(const struct particle_index *index, int p,
+			       int x, int y, int z)
+{
+	const int *c = &index->cells[p * 3];
+
+	return c[0] == x && c[1] == y && c[2] == z;
+}
+
+static inline float get_distance2(const struct particle_index *index, int p,
+				  const float *position)
+{
+	const float *x = &index->positions[p * 3];
+	float d2 = 0;
+	int j;
+
+	for (j = 0; j < 3; j++)
+		d2 += (x[j] - position[j]) * (x[j] - position[j]);
+
+	return d2;
+}
+
+void particle_index_remove(struct particle_index *index, int particle)
+{
+	int b = index->bucket[particle];
+
+	if (b < 0)
+		return;
+
+	if (index->prev[particle] >= 0)
+		index->next[index->prev[particle]] = index->next[particle];
+	else
+		index->bucket_head[b] = index->next[particle];
+
+	if (index->next[particle] >= 0)
+		index->prev[index->next[particle]] = index->prev[particle];
+
+	index->bucket[particle] = -1;
+	index->live_count--;
+}
+
+void particle_index_update(struct particle_index *index, int particle,
+			   const float *position)
+{
+	int c[3], j, b;
+
+	for (j = 0; j < 3; j++) {
+		index->positions[particle * 3 + j] = position[j];
+		c[j] = get_coord(index, position[j]);
+	}
+
+	/* Most particles stay in the same cell from one update to the next */
+	if (index->bucket[particle] >= 0 &&
+	    in_cell(index, particle, c[0], c[1], c[2]))
+		return;
+
+	particle_index_remove(index, particle);
+
+	for (j = 0; j < 3; j++)
+		index->cells[particle * 3 + j] = c[j];
+
+	b = get_bucket(index, c[0], c[1], c[2]);
+
+	index->prev[particle] = -1;
+	index->next[particle] = index->bucket_head[b];
+	if (index->bucket_head[b] >= 0)
+		index->prev[index->bucket_head[b]] = particle;
+	index->bucket_head[b] = particle;
+
+	index->bucket[particle] = b;
+	index->live_count++;
+}
+
+/*
+ * Return whether a search of the given number of cells would be slower than
+ * visiting every particle.
+ */
+static gboolean too_many_cells(const struct particle_index *index,
+			       double cells)
+{
+	return cells > (double)index->live_count * MAX_CELLS_PER_PARTICLE + 64;
+}
+
+int particle_index_find_radius(const struct particle_index *index,
+			       const float *position, float radius,
+			       int *results, int max_results)
+{
+	float radius2 = radius * radius;
+	int lo[3], hi[3], x, y, z, p, j, count = 0;
+	double cells = 1;
+
+	if (max_results < 1)
+		return 0;
+
+	for (j = 0; j < 3; j++) {
+		lo[j] = get_coord(index, position[j] - radius);
+		hi[j] = get_coord(index, position[j] + radius);
+		cells *= (double)hi[j] - lo[j] + 1;
+	}
+
+	if (too_many_cells(index, cells)) {
+		for (p = 0; p < index->particle_count; p++) {
+			if (index->bucket[p] >= 0 &&
+			    get_distance2(index, p, position) <= radius2) {
+				results[count++] = p;
+				if (count == max_results)
+					break;
+			}
+		}
+
+		return count;
+	}
+
+	for (z = lo[2]; z <= hi[2]; z++) {
+		for (y = lo[1]; y <= hi[1]; y++) {
+			for (x = lo[0]; x <= hi[0]; x++) {
+				p = index->bucket_head[get_bucket(index, x, y, z)];
+
+				for ( ; p >= 0; p = index->next[p]) {
+					if (!in_cell(index, p, x, y, z) ||
+					    get_distance2(index, p, position) > radius2)
+						continue;
+
+					results[count++] = p;
+					if (count == max_results)
+						return count;
+				}
+			}
+		}
+	}
+
+	return count;
+}
+
+/*
+ * Insert a particle into a list of the nearest particles found so far, which
+ * is sorted by distance and holds at most k particles.
+ */
+static void insert_nearest(int *nearest, float *nearest_distance2,
+			   int *count, int k, int p, float distance2)
+{
+	int i;
+
+	if (*count == k && distance2 >= nearest_distance2[k - 1])
+		return;
+
+	i = *count < k ? (*count)++ : k - 1;
+
+	for ( ; i > 0 && nearest_distance2[i - 1] > distance2; i--) {
+		nearest[i] = nearest[i - 1];
+		nearest_distance2[i] = nearest_distance2[i - 1];
+	}
+
+	nearest[i] = p;
+	nearest_distance2[i] = distance2;
+}
+
+int particle_index_find_nearest(const struct particle_index *index,
+				const float *position, int k, int *results)
+{
+	float *distance2, covered;
+	int c[3], r, x, y, z, p, j, count = 0;
+
+	k = MIN(k, index->live_count);
+	if (k < 1)
+		return 0;
+
+	distance2 = g_new(float, k);
+
+	for (j = 0; j < 3; j++)
+		c[j] = get_coord(index, position[j]);
+
+	/* Visit shells of cells of increasing size around the particle's cell
+	 * until the furthest of the k nearest particles found is no further
+	 * than the nearest point outside of the shells. */
+	for (r = 0; ; r++) {
+		if (too_many_cells(index, pow(2 * r + 1, 3))) {
+			count = 0;
+
+			for (p = 0; p < index->particle_count; p++) {
+				if (index->bucket[p] >= 0)
+					insert_nearest(results, distance2,
+						       &count, k, p,
+						       get_distance2(index, p, position));
+			}
+
+			break;
+		}
+
+		for (z = c[2] - r; z <= c[2] + r; z++) {
+			for (y = c[1] - r; y <= c[1] + r; y++) {
+				/* Only the first and last cells of rows inside
+				 * of the shell are on the shell. */
+				int step = abs(z - c[2]) == r ||
+					abs(y - c[1]) == r ? 1 : 2 * r;
+
+				for (x = c[0] - r; x <= c[0] + r; x += MAX(step, 1)) {
+					p = index->bucket_head[get_bucket(index, x, y, z)];
+
+					for ( ; p >= 0; p = index->next[p]) {
+						if (in_cell(index, p, x, y, z))
+							insert_nearest(results, distance2,
+								       &count, k, p,
+								       get_distance2(index, p, position));
+					}
+				}
+			}
+		}
+
+		covered = r * index->cell_size;
+
+		if (count == k && distance2[k - 1] <= covered * covered)
+			break;
+	}
+
+	g_free(distance2);
+
+	return count;
+}
+
+int particle_index_find_ray(const struct particle_index *index,
+			    const float *origin, const float *direction,
+			    float radius, float max_distance, float *distance)
+{
+	float d[3], length, t_max[3], t_delta[3], t = 0, best_t = max_distance;
+	float radius2 = radius * radius;
+	int c[3], step[3], reach, best = -1, j, x, y, z, p;
+
+	length = sqrtf(direction[0] * direction[0] +
+		       direction[1] * direction[1] +
+		       direction[2] * direction[2]);
+
+	if (length <= 0 || index->live_count < 1)
+		return -1;
+
+	/* The cells of particles which are within radius of a point on the ray
+	 * are at most reach cells from the cell of that point. */
+	reach = (int)ceilf(radius * index->inv_cell_size);
+
+	/* A long ray is cheaper to test against every particle */
+	if (too_many_cells(index, (max_distance * index->inv_cell_size * 3 + 1) *
+			   pow(2 * reach + 1, 3))) {
+		for (p = 0; p < index->particle_count; p++) {
+			const float *position = &index->positions[p * 3];
+			float v[3], along = 0, d2 = 0;
+
+			if (index->bucket[p] < 0)
+				continue;
+
+			for (j = 0; j < 3; j++) {
+				v[j] = position[j] - origin[j];
+				along += v[j] * direction[j] / length;
+				d2 += v[j] * v[j];
+			}
+
+			if (along < 0 || along > best_t ||
+			    d2 - along * along > radius2)
+				continue;
+
+			best = p;
+			best_t = along;
+		}
+
+		if (distance && best >= 0)
+			*distance = best_t;
+
+		return best;
+	}
+
+	/* Walk the cells along the ray (Amanatides & Woo) */
+	for (j = 0; j < 3; j++) {
+		d[j] = direction[j] / length;
+		c[j] = get_coord(index, origin[j]);
+		step[j] = d[j] < 0 ? -1 : 1;
+
+		if (d[j] != 0) {
+			float boundary = (c[j] + (d[j] > 0)) * index->cell_size;
+
+			t_max[j] = (boundary - origin[j]) / d[j];
+			t_delta[j] = index->cell_size / fabsf(d[j]);
+		} else {
+			t_max[j] = G_MAXFLOAT;
+			t_delta[j] = G_MAXFLOAT;
+		}
+	}
+
+	/* A particle at distance t along the ray is found when the walk
+	 * reaches the cell containing that point of the ray, so the walk can
+	 * stop as soon as it passes the nearest particle found. */
+	while (t <= best_t) {
+		for (z = c[2] - reach; z <= c[2] + reach; z++) {
+			for (y = c[1] - reach; y <= c[1] + reach; y++) {
+				for (x = c[0] - reach; x <= c[0] + reach; x++) {
+					p = index->bucket_head[get_bucket(index, x, y, z)];
+
+					for ( ; p >= 0; p = index->next[p]) {
+						const float *position = &index->positions[p * 3];
+						float v[3], along = 0, d2 = 0;
+
+						if (!in_cell(index, p, x, y, z))
+							continue;
+
+						for (j = 0; j < 3; j++) {
+							v[j] = position[j] - origin[j];
+							along += v[j] * d[j];
+							d2 += v[j] * v[j];
+						}
+
+						if (along < 0 || along > best_t ||
+						    d2 - along * along > radius2)
+							continue;
+
+						best = p;
+						best_t = along;
+					}
+				}
+			}
+		}
+
+		/* Step into the next cell */
+		j = t_max[0] < t_max[1] ?
+			(t_max[0] < t_max[2] ? 0 : 2) :
+			(t_max[1] < t_max[2] ? 1 : 2);
+
+		t = t_max[j];
+		t_max[j] += t_delta[j];
+		c[j] += step[j];
+	}
+
+	if (distance && best >= 0)
+		*distance = best_t;
+
+	return best;
+}
+
+void particle_index_query(const struct particle_index *index,
+			  struct particle_query *query)
+{
+	int p;
+
+	switch (query->type) {
+	case PARTICLE_QUERY_RADIUS:
+		query->result_count = particle_index_find_radius(index,
+								 query->position,
+								 query->radius,
+								 query->results,
+								 query->max_results);
+		break;
+	case PARTICLE_QUERY_NEAREST:
+		query->result_count = particle_index_find_nearest(index,
+								  query->position,
+								  query->max_results,
+								  query->results);
+		break;
+	case PARTICLE_QUERY_RAY:
+		p = particle_index_find_ray(index, query->position,
+					    query->direction, query->radius,
+					    query->max_distance, NULL);
+
+		query->result_count = p >= 0;
+		if (p >= 0)
+			query->results[0] = p;
+		break;
+	}
+}
+
+struct query_batch {
+	const struct particle_index *index;
+	struct particle_query *queries;
+};
+
+static void run_queries(gpointer data, int start, int end, int worker)
+{
+	struct query_batch *batch = data;
+	int i;
+
+	(void)worker;
+
+	for (i = start; i < end; i++)
+		particle_index_query(batch->index, &batch->queries[i]);
+}
+
+void particle_index_query_batch(const struct particle_index *index,
+				struct particle_query *queries, int count,
+				struct worker_pool *pool)
+{
+	struct query_batch batch = { index, queries };
+
+	if (pool)
+		worker_pool_run_chunks(pool, count, QUERY_CHUNK_SIZE,
+				       run_queries, &batch);
+	else
+		run_queries(&batch, 0, count, 0);
+}
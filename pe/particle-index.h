@@ -0,0 +1,151 @@
+/*
+ *         particle-index.h -- Spatial queries over particles.
+ *
+ * A particle index answers queries about where particles are: which particles
+ * are within a radius of a point, which are the k nearest to it, and which is
+ * the first particle along a ray. It is used for picking particles with a
+ * cursor, and for effects which only touch the particles near a point.
+ *
+ * The index bins particles into cubic cells, which are hashed into a fixed
+ * number of buckets, so it can hold particles anywhere in space. Each bucket
+ * keeps a linked list of it's particles. Particles are updated one at a time as
+ * they move, and a particle which stays within it's cell (the common case from
+ * one tick to the next) costs no more than a copy of it's position. The index
+ * is therefore maintained incrementally alongside a simulation, rather than
+ * rebuilt for every query.
+ *
+ * The index keeps it's own copy of the particle positions, so queries never
+ * need to touch the vertex buffer. Queries are read-only, so any number may be
+ * run concurrently, but not while the index is being updated.
+ */
+#ifndef _PARTICLE_INDEX_H_
+#define _PARTICLE_INDEX_H_
+
+#include "worker-pool.h"
+
+#include <glib.h>
+
+struct particle_index {
+	/* The length of the edge of a cell, and it's reciprocal. */
+	float cell_size;
+	float inv_cell_size;
+
+	/* The first particle in each bucket, or -1 if empty. The number of
+	 * buckets is a power of two. */
+	int *bucket_head;
+	int bucket_count;
+
+	/* The number of particles that the index can hold, and the number
+	 * which are currently in it. */
+	int particle_count;
+	int live_count;
+
+	/* The position and cell coordinates of each particle. */
+	float *positions;
+	int *cells;
+
+	/* The bucket of each particle, or -1 if the particle is not in the
+	 * index, and the next and previous particles in the same bucket. */
+	int *bucket;
+	int *next;
+	int *prev;
+};
+
+/*
+ * A spatial query, for running many queries at once with
+ * particle_index_query_batch().
+ */
+struct particle_query {
+	enum {
+		/* Find up to max_results particles within radius of
+		 * position, in no particular order. */
+		PARTICLE_QUERY_RADIUS,
+
+		/* Find the max_results particles nearest to position,
+		 * nearest first. */
+		PARTICLE_QUERY_NEAREST,
+
+		/* Find the first particle within radius of the ray from
+		 * position along direction, up to max_distance from
+		 * position. */
+		PARTICLE_QUERY_RAY
+	} type;
+
+	float position[3];
+	float direction[3];
+	float radius;
+	float max_distance;
+
+	/* The array that the indices of the particles found are written to,
+	 * which must have room for max_results particles (or one, for ray
+	 * queries). */
+	int *results;
+	int max_results;
+
+	/* Set to the number of particles found. */
+	int result_count;
+};
+
+/*
+ * Create an empty index for particles with indices in the range [0,
+ * particle_count). Queries are fastest when cell_size is close to the radius
+ * of a typical query.
+ */
+struct particle_index *particle_index_new(int particle_count, float cell_size);
+
+void particle_index_free(struct particle_index *index);
+
+/*
+ * Add the particle with the given index at position, or move it there if it is
+ * already in the index.
+ */
+void particle_index_update(struct particle_index *index, int particle,
+			   const float *position);
+
+/*
+ * Remove a particle from the index, if it is in it.
+ */
+void particle_index_remove(struct particle_index *index, int particle);
+
+/*
+ * Write the indices of up to max_results particles within radius of position
+ * to results, and return the number written.
+ */
+int particle_index_find_radius(const struct particle_index *index,
+			       const float *position, float radius,
+			       int *results, int max_results);
+
+/*
+ * Write the indices of the k particles nearest to position to results,
+ * nearest first, and return the number written, which is less than k only if
+ * the index holds fewer than k particles.
+ */
+int particle_index_find_nearest(const struct particle_index *index,
+				const float *position, int k, int *results);
+
+/*
+ * Return the index of the first particle whose center lies within radius of
+ * the ray from origin along direction, or -1 if there is no such particle
+ * within max_distance of origin. The direction need not be normalized. If
+ * distance is not NULL, then it is set to the distance along the ray to the
+ * particle.
+ */
+int particle_index_find_ray(const struct particle_index *index,
+			    const float *origin, const float *direction,
+			    float radius, float max_distance, float *distance);
+
+/*
+ * Run a single query.
+ */
+void particle_index_query(const struct particle_index *index,
+			  struct particle_query *query);
+
+/*
+ * Run count queries, shared between the workers of pool, which may be NULL to
+ * run them serially.
+ */
+void particle_index_query_batch(const struct particle_index *index,
+				struct particle_query *queries, int count,
+				struct worker_pool *pool);
+
+#endif /* _PARTICLE_INDEX_H_ */
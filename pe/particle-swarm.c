@@ -1,18 +1,108 @@
 #include "particle-swarm.h"
 
+#include "morton.h"
 #include "particle-engine.h"
+#include "process-pool.h"
+#include "spatial-grid.h"
+#include "swarm-compact.h"
+#include "swarm-kernel.h"
+#include "swarm-octree.h"
+#include "swarm-snapshot.h"
+#include "swarm-tuner.h"
+#include "worker-pool.h"
 
 #include <cogl/cogl.h>
 #include <math.h>
 #include <string.h>
 
 #define MAX_FRAME_TIME 0.015
+
+/* The default interval between ticks. */
 #define DT 0.005
 
-struct particle {
-	float velocity[3];
-	float speed;
-	float size;
+/* The maximum number of grid cells per particle used for neighbour
+ * searches. This bounds the memory used by the grid when particles have a
+ * short range of sight. */
+#define GRID_CELLS_PER_PARTICLE 2
+
+/* The margin around the swarm's boundary that compact positions can
+ * represent, as a fraction of the boundary. Particles rarely stray far past
+ * the soft boundaries. */
+#define COMPACT_MARGIN 0.25f
+
+/* The number of particles in each block of the hive sums. The blocks are
+ * summed concurrently, then added up in order, so the sums do not depend on
+ * the number of threads. */
+#define HIVE_BLOCK_SIZE 4096
+
+/* The number of blocks that the particles are split into per worker when
+ * accumulating the interactions between pairs of particles. */
+#define PAIR_BLOCKS_PER_WORKER 4
+
+/* The most ranges of particles that a particle in a grid visits when
+ * accumulating the interactions between pairs: the rest of it's own row,
+ * the next row of it's layer, and three rows of the next layer. */
+#define PAIR_MAX_RANGES 5
+
+/* The number of bands that a particle of a divided swarm can move from the
+ * band it was last sorted into before the particles are sorted again. The
+ * ghosts of each slab are widened by this many bands on either side. */
+#define SLAB_SLACK 1
+
+/* The drift in tick time which makes the tuner retune, if the swarm doesn't
+ * give one. */
+#define AUTOTUNE_THRESHOLD 0.25f
+
+/* The number of particles created from each random stream. The streams are
+ * shared out between workers when there is more than one. */
+#define CREATE_CHUNK_SIZE 4096
+
+/* The parameters that the tuner can choose. */
+enum {
+	TUNE_THREAD_COUNT,
+	TUNE_REORDER_INTERVAL,
+	TUNE_GRID_CELL_SCALE,
+	TUNE_VERLET_SKIN,
+	TUNE_PARAMETER_COUNT
+};
+
+/*
+ * The particles owned by a slab of a divided swarm, and the wider range of
+ * particles that it sees, which includes the ghosts on either side.
+ */
+struct slab {
+	int owned_start;
+	int owned_end;
+	int ghost_start;
+	int ghost_end;
+};
+
+/*
+ * The state that the coordinator of a divided swarm shares with it's
+ * processes. This is followed in the shared memory by the particle buffers.
+ * The processes are forked before the coordinator's own state is complete,
+ * so everything that they need is found from here.
+ */
+struct slab_state {
+	/* The swarm which each process uses to tick it's slab, and the
+	 * particle buffers. */
+	struct particle_swarm *slab;
+	struct swarm_arrays buffers[2];
+
+	/* A copy of the swarm's configuration as of the start of the tick, so
+	 * that changes made after the processes were forked reach them. */
+	struct particle_swarm config;
+
+	/* Which of the particle buffers is the front buffer. */
+	int front;
+
+	/* The velocity and position sums of the whole swarm, for
+	 * SWARM_TYPE_HIVE swarms. */
+	float velocity_sum[3];
+	float position_sum[3];
+
+	/* The slab of each process. */
+	struct slab slabs[];
 };
 
 struct particle_swarm_priv {
@@ -20,9 +110,29 @@ struct particle_swarm_priv {
 	gdouble current_time;
 	gdouble accumulator;
 
+	/* The interval between ticks, updated once per tick. */
+	float dt;
+
 	GRand *rand;
 
-	struct particle *particles;
+	/* The seed of the random streams that the particles are created
+	 * from. */
+	guint32 create_seed;
+
+	/* The particle state is double buffered. During a tick, every particle
+	 * reads the state of the swarm from the front buffer (particles) and
+	 * writes it's new state to the back buffer (next_particles), so the
+	 * particles can be updated in any order, or concurrently. The buffers
+	 * are swapped at the end of each tick, which leaves the previous state
+	 * in the back buffer until the next tick, for interpolation. */
+	struct swarm_arrays buffers[2];
+	struct swarm_arrays *particles;
+	struct swarm_arrays *next_particles;
+
+	/* The workers used to update particles, and the thread count that they
+	 * were created with. */
+	struct worker_pool *pool;
+	int thread_count;
 
 	/* The hard particle boundaries. */
 	float boundary[3];
@@ -40,9 +150,16 @@ struct particle_swarm_priv {
 	float velocity_sum[3];
 	float position_sum[3];
 
-	/* Strength of cohesion and boundary forces, updated once per tick. */
+	/* The velocity and position sums of each block of HIVE_BLOCK_SIZE
+	 * particles, 6 floats per block. */
+	float *hive_block_sums;
+
+	/* Strength of separation, cohesion, boundary and obstacle forces,
+	 * updated once per tick. */
+	float separation_accel;
 	float cohesion_accel;
 	float boundary_accel;
+	float obstacle_accel;
 
 	/* Global acceleration force vector, updated once per tick. */
 	float global_accel[3];
@@ -52,6 +169,129 @@ struct particle_swarm_priv {
 		float max;
 	} speed_limits;
 
+	/* The spatial grid used for SWARM_SEARCH_GRID neighbour searches, and
+	 * the cell size it was requested with. The grid is rebuilt once per
+	 * tick. The cells are at least as large as the search radius. */
+	struct spatial_grid *grid;
+	float grid_cell_size;
+
+	/* A copy of the front buffer, sorted by grid cell. The particles in
+	 * each row of grid cells are contiguous, so that they can be passed
+	 * to the interaction kernel as a single range. */
+	struct swarm_arrays sorted;
+
+	/* The same copy in quantized form, used in place of sorted by swarms
+	 * with compact storage (see is_compact()). */
+	struct swarm_compact_arrays sorted_compact;
+
+	/* The octree used for SWARM_SEARCH_OCTREE swarms, which is rebuilt
+	 * once per tick. */
+	struct swarm_octree *octree;
+
+	/* The distance within which a particle must search for neighbours,
+	 * updated once per tick. */
+	float search_radius;
+
+	/* The totals accumulated over the neighbours of each particle, for
+	 * SWARM_SEARCH_GRID and SWARM_SEARCH_BRUTE_FORCE swarms. Each pair of
+	 * particles is visited once, by the first of the pair, and the
+	 * particles are split into blocks which are accumulated concurrently.
+	 * The particles of a block only reach the particles which follow them
+	 * by up to a layer of grid cells, so each block accumulates into a
+	 * window of sums covering the range [pair_block_start[b],
+	 * pair_block_reach[b]), and only the overlaps between windows need to
+	 * be added together. These are then reduced into a single set, indexed
+	 * by particle. */
+	struct swarm_sums *pair_block_sums;
+	int *pair_block_start;
+	int *pair_block_reach;
+	int pair_block_count;
+	struct swarm_sums sums;
+
+	/* The neighbour lists of SWARM_SEARCH_VERLET swarms. The neighbours of
+	 * particle i are neighbours[neighbour_start[i]] up to (but not
+	 * including) neighbours[neighbour_start[i + 1]]. */
+	int *neighbour_start;
+	int *neighbours;
+	int neighbour_capacity;
+
+	/* The radius that the neighbour lists were built with, or zero if they
+	 * need building, and the particle positions at the time. */
+	float neighbour_radius;
+	float *neighbour_positions;
+
+	/* The number of ticks since the particles were last reordered, and the
+	 * scratch space used to reorder them. */
+	int ticks_since_reorder;
+	guint32 *reorder_codes;
+	int *reorder_indices;
+	guint32 *reorder_scratch_codes;
+	int *reorder_scratch_indices;
+	CoglColor *reorder_colors;
+
+	/* The number of ticks since the swarm was created. */
+	int tick_count;
+
+	/* The cached neighbour sums of each particle when they are not
+	 * recomputed every tick (see is_staggered()), along with the tick that they were computed on (or
+	 * -1 if they need computing), and the particle's position at the
+	 * time. */
+	struct swarm_sums aggregate_sums;
+	int *aggregate_tick;
+	float *aggregate_positions;
+
+	struct particle_swarm_stats stats;
+
+	/* The index used for spatial queries, which is created by the first
+	 * query and updated every tick from then on. */
+	struct particle_index *index;
+
+	/* The group that the swarm belongs to, if any. The particles of a
+	 * grouped swarm are stored and drawn by the group, and start at
+	 * particle_offset in the group's buffers and engine. */
+	struct particle_swarm_group *group;
+	int particle_offset;
+
+	/* The processes which share the particles of a divided swarm (see
+	 * process_count), the state shared with them, and the swarm that each
+	 * process uses to tick it's slab. The particle buffers of a divided
+	 * swarm are in the shared memory. */
+	struct process_pool *processes;
+	struct slab_state *shared;
+	struct particle_swarm *slab;
+
+	/* The width and number of the bands that the particles of a divided
+	 * swarm were last sorted into, or zero if they haven't been. The band
+	 * of each particle is kept in reorder_codes. */
+	float band_width;
+	int band_count;
+
+	/* Whether the swarm is the slab of a divided swarm, and the range of
+	 * particles that each tick updates. A slab only updates the particles
+	 * that it owns, and the rest are ghosts which are only seen as
+	 * neighbours. */
+	gboolean is_slab;
+	int update_start;
+	int update_end;
+
+	/* The number of particles that the search structures are allocated
+	 * for, if more than particle_count. The particle count of a slab
+	 * changes from tick to tick. */
+	int capacity;
+
+	/* The tuner of an autotuned swarm, created on the first tick, and the
+	 * index of each parameter in it, or -1 if it isn't tuned. */
+	struct swarm_tuner *tuner;
+	int tune_parameters[TUNE_PARAMETER_COUNT];
+
+	/* The thread creating the particles of a prepared swarm, until it is
+	 * joined by the first paint (see particle_swarm_prepare()). */
+	GThread *prepare_thread;
+
+	/* The snapshot that a loaded swarm is restored from, which the
+	 * particle buffers point into (see particle_swarm_load()). */
+	struct swarm_snapshot *snapshot;
+
 	CoglContext *ctx;
 	CoglFramebuffer *fb;
 	struct particle_engine *engine;
@@ -74,9 +314,25 @@ struct particle_swarm* particle_swarm_new(CoglContext *ctx,
 	return swarm;
 }
 
+/*
+ * Wait for the thread preparing the swarm, if there is one.
+ */
+static void join_prepare_thread(struct particle_swarm *swarm)
+{
+	struct particle_swarm_priv *priv = swarm->priv;
+
+	if (priv->prepare_thread) {
+		g_thread_join(priv->prepare_thread);
+		priv->prepare_thread = NULL;
+	}
+}
+
 void particle_swarm_free(struct particle_swarm *swarm)
 {
 	struct particle_swarm_priv *priv = swarm->priv;
+	int i;
+
+	join_prepare_thread(swarm);
 
 	cogl_object_unref(priv->ctx);
 	cogl_object_unref(priv->fb);
@@ -84,52 +340,106 @@ void particle_swarm_free(struct particle_swarm *swarm)
 	g_rand_free(priv->rand);
 	g_timer_destroy(priv->timer);
 
-	particle_engine_free(priv->engine);
+	/* Grouped swarms share the group's engine and particle storage. */
+	if (!priv->group && priv->engine)
+		particle_engine_free(priv->engine);
+
+	if (priv->processes)
+		process_pool_free(priv->processes);
+
+	if (priv->slab)
+		particle_swarm_free(priv->slab);
+
+	if (priv->tuner)
+		swarm_tuner_free(priv->tuner);
+
+	if (priv->grid)
+		spatial_grid_free(priv->grid);
+
+	if (priv->pool)
+		worker_pool_free(priv->pool);
+
+	swarm_arrays_clear(&priv->buffers[0]);
+	swarm_arrays_clear(&priv->buffers[1]);
+	swarm_arrays_clear(&priv->sorted);
+
+	if (priv->snapshot)
+		swarm_snapshot_free(priv->snapshot);
+	swarm_compact_arrays_clear(&priv->sorted_compact);
+
+	if (priv->octree)
+		swarm_octree_free(priv->octree);
+
+	if (priv->index)
+		particle_index_free(priv->index);
+
+	for (i = 0; i < priv->pair_block_count; i++)
+		swarm_sums_clear(&priv->pair_block_sums[i]);
+	g_free(priv->pair_block_sums);
+	g_free(priv->pair_block_start);
+	g_free(priv->pair_block_reach);
+	swarm_sums_clear(&priv->sums);
+
+	g_free(priv->neighbour_start);
+	g_free(priv->neighbours);
+	g_free(priv->neighbour_positions);
+
+	g_free(priv->reorder_codes);
+	g_free(priv->reorder_indices);
+	g_free(priv->reorder_scratch_codes);
+	g_free(priv->reorder_scratch_indices);
+	g_free(priv->reorder_colors);
+
+	swarm_sums_clear(&priv->aggregate_sums);
+	g_free(priv->aggregate_tick);
+	g_free(priv->aggregate_positions);
+	g_free(priv->hive_block_sums);
 
 	g_slice_free(struct particle_swarm_priv, priv);
 	g_slice_free(struct particle_swarm, swarm);
 }
 
-static void create_particle(struct particle_swarm *swarm,
+static void create_particle(struct particle_swarm *swarm, GRand *rand,
 			    int index)
 {
 	struct particle_swarm_priv *priv = swarm->priv;
-	struct particle *particle = &priv->particles[index];
+	struct swarm_arrays *particles = priv->particles;
 	float *position;
 	CoglColor *color;
 	int i;
 
-	position = particle_engine_get_particle_position(priv->engine, index);
-	color = particle_engine_get_particle_color(priv->engine, index);
+	position = particle_engine_get_particle_position(priv->engine,
+							 priv->particle_offset + index);
+	color = particle_engine_get_particle_color(priv->engine,
+						   priv->particle_offset + index);
 
-	particle->speed = 1;
-	particle->size = g_rand_double(priv->rand) + 0.5;
+	particles->speed[index] = 1;
+	particles->size[index] = SWARM_MIN_PARTICLE_SIZE + g_rand_double(rand) *
+		(SWARM_MAX_PARTICLE_SIZE - SWARM_MIN_PARTICLE_SIZE);
 
 	/* Particle color. */
-	fuzzy_color_get_cogl_color(&swarm->particle_color, priv->rand, color);
+	fuzzy_color_get_cogl_color(&swarm->particle_color, rand, color);
 
 	/* Particles start at a random point within the swarm space */
 	for (i = 0; i < 3; i++) {
-		position[i] = g_rand_double_range(priv->rand,
+		position[i] = g_rand_double_range(rand,
 						  priv->boundary_min[i],
 						  priv->boundary_max[i]);
+		particles->position[i][index] = position[i];
 
 		/* Random starting velocity */
-		particle->velocity[i] = (g_rand_double(priv->rand) - 0.5) * 4;
+		particles->velocity[i][index] = (g_rand_double(rand) - 0.5) * 4;
 	}
 }
 
-static void create_resources(struct particle_swarm *swarm)
+/*
+ * Set the hard and soft boundaries from the swarm's dimensions.
+ */
+static void update_boundaries(struct particle_swarm *swarm)
 {
 	struct particle_swarm_priv *priv = swarm->priv;
 	int i;
 
-	priv->engine = particle_engine_new(priv->ctx, priv->fb,
-					   swarm->particle_count,
-					   swarm->particle_size);
-
-	priv->particles = g_new0(struct particle, swarm->particle_count);
-
 	priv->boundary[0] = swarm->width;
 	priv->boundary[1] = swarm->height;
 	priv->boundary[2] = swarm->depth;
@@ -139,76 +449,535 @@ static void create_resources(struct particle_swarm *swarm)
 			swarm->boundary_threshold;
 		priv->boundary_max[i] = priv->boundary[i] - priv->boundary_min[i];
 	}
+}
 
-	particle_engine_push_buffer(priv->engine,
-				    COGL_BUFFER_ACCESS_READ_WRITE, 0);
+/*
+ * Create the swarm's particles. The particle buffers and engine must already
+ * exist, and the engine's buffer must be mapped.
+ */
+static void create_particle_chunks(gpointer data, int start, int end,
+				   int worker)
+{
+	struct particle_swarm *swarm = data;
+	int c, i;
 
-	for (i = 0; i < swarm->particle_count; i++)
-		create_particle(swarm, i);
+	(void)worker;
 
-	particle_engine_pop_buffer(priv->engine);
+	for (c = start; c < end; c++) {
+		guint32 seed[2] = { swarm->priv->create_seed, c };
+		GRand *rand = g_rand_new_with_seed_array(seed,
+							 G_N_ELEMENTS(seed));
+		int last = MIN((c + 1) * CREATE_CHUNK_SIZE,
+			       swarm->particle_count);
+
+		for (i = c * CREATE_CHUNK_SIZE; i < last; i++)
+			create_particle(swarm, rand, i);
+
+		g_rand_free(rand);
+	}
 }
 
-static void particle_apply_swarming_behaviour(struct particle_swarm *swarm,
-					      int index, float *v)
+/*
+ * Restore the particles of a loaded swarm from it's snapshot, in place of
+ * creating them.
+ */
+static void restore_particles(struct particle_swarm *swarm)
 {
 	struct particle_swarm_priv *priv = swarm->priv;
-	struct particle *particle = &priv->particles[index];
-	float *position, center_of_mass[3] = {0}, velocity_avg[3] = {0};
-	int i, j, swarm_size = 0;
+	struct swarm_snapshot *snapshot = priv->snapshot;
+	const float *rgba;
+	int i;
 
-	position = particle_engine_get_particle_position(priv->engine, index);
+	priv->particles = &priv->buffers[0];
+	priv->next_particles = &priv->buffers[1];
+
+	update_boundaries(swarm);
+
+	priv->create_seed = snapshot->create_seed;
+	priv->tick_count = snapshot->tick_count;
+	priv->ticks_since_reorder = snapshot->ticks_since_reorder;
 
-	/* Iterate over every *other* particle */
 	for (i = 0; i < swarm->particle_count; i++) {
-		if (i != index) {
-			float *pos, dx, dy, dz, distance;
-			struct particle *other_particle = &priv->particles[i];
-
-			pos = particle_engine_get_particle_position(priv->engine, i);
-
-			dx = position[0] - pos[0];
-			dy = position[1] - pos[1];
-			dz = position[2] - pos[2];
-
-			/* Get the distance between the other particle and this
-			 * particle */
-			distance = sqrt(dx * dx + dy * dy + dz * dz);
-
-			/*
-			 * COLLISION AVOIDANCE
-			 *
-			 * Particles try to keep a small distance away from
-			 * other particles to prevent them bumping into each
-			 * other and reduce the density of the swarm:
-			 */
-			if (distance < swarm->particle_distance) {
-				/* FIXME: is this correct? */
-				for (j = 0; j < 3; j++) {
-					v[j] -= (pos[j] - position[j]) *
-						swarm->particle_repulsion_rate;
-				}
+		rgba = &snapshot->colors[i * 4];
+		cogl_color_init_from_4f(particle_engine_get_particle_color(priv->engine, i),
+					rgba[0], rgba[1], rgba[2], rgba[3]);
+	}
+
+	/* The buffers of a divided swarm are in shared memory, so the
+	 * snapshot is copied there, and isn't needed after. */
+	if (priv->processes) {
+		for (i = 0; i < 2; i++)
+			memcpy(priv->buffers[i].position[0],
+			       snapshot->buffers[i].position[0],
+			       swarm_arrays_get_size(swarm->particle_count));
+
+		swarm_snapshot_free(snapshot);
+		priv->snapshot = NULL;
+	}
+}
+
+static void create_particles(struct particle_swarm *swarm)
+{
+	struct particle_swarm_priv *priv = swarm->priv;
+	struct worker_pool *pool;
+	int chunk_count = (swarm->particle_count + CREATE_CHUNK_SIZE - 1) /
+		CREATE_CHUNK_SIZE;
+
+	priv->particles = &priv->buffers[0];
+	priv->next_particles = &priv->buffers[1];
+
+	update_boundaries(swarm);
+
+	/* Each chunk of particles is created from a random stream of it's
+	 * own, so the particles don't depend on the number of threads, and
+	 * the particles of a reproducible swarm only depend on it's seed. */
+	priv->create_seed = swarm->reproducible ? swarm->seed :
+		g_rand_int(priv->rand);
+
+	pool = worker_pool_new(chunk_count > 1 ?
+			       MAX(swarm->thread_count, 1) : 1);
+	worker_pool_run_chunks(pool, chunk_count, 1, create_particle_chunks,
+			       swarm);
+	worker_pool_free(pool);
+}
+
+/*
+ * Fork the processes of a divided swarm, and place it's particle buffers in
+ * the memory that they share.
+ */
+static void create_processes(struct particle_swarm *swarm, int process_count)
+{
+	struct particle_swarm_priv *priv = swarm->priv;
+	size_t state_size, buffer_size;
+	char *shared;
+
+	/* The buffers must stay aligned for the interaction kernel. */
+	state_size = sizeof(struct slab_state) +
+		sizeof(struct slab) * process_count;
+	state_size = (state_size + SWARM_ALIGNMENT - 1) /
+		SWARM_ALIGNMENT * SWARM_ALIGNMENT;
+	buffer_size = swarm_arrays_get_size(swarm->particle_count);
+
+	/* Every process ticks it's own copy of the slab swarm, so it must
+	 * exist before they are forked. */
+	priv->slab = particle_swarm_new(priv->ctx, priv->fb);
+	priv->slab->priv->is_slab = TRUE;
+	priv->slab->priv->capacity = swarm->particle_count;
+
+	priv->processes = process_pool_new(process_count,
+					   state_size + buffer_size * 2);
+	shared = process_pool_get_shared(priv->processes);
+
+	priv->shared = (struct slab_state *)shared;
+	swarm_arrays_init_with_data(&priv->buffers[0], swarm->particle_count,
+				    shared + state_size);
+	swarm_arrays_init_with_data(&priv->buffers[1], swarm->particle_count,
+				    shared + state_size + buffer_size);
+
+	priv->shared->slab = priv->slab;
+	priv->shared->buffers[0] = priv->buffers[0];
+	priv->shared->buffers[1] = priv->buffers[1];
+}
+
+/*
+ * Create the particle buffers. The processes of a divided swarm are forked
+ * here, so this must be called before any other threads are started for the
+ * swarm.
+ */
+static void create_buffers(struct particle_swarm *swarm)
+{
+	struct particle_swarm_priv *priv = swarm->priv;
+
+	if (swarm->process_count > 1) {
+		create_processes(swarm, swarm->process_count);
+	} else if (priv->snapshot) {
+		/* Loaded swarms use the snapshot's arrays in place. */
+		priv->buffers[0] = priv->snapshot->buffers[0];
+		priv->buffers[1] = priv->snapshot->buffers[1];
+	} else {
+		swarm_arrays_init(&priv->buffers[0], swarm->particle_count);
+		swarm_arrays_init(&priv->buffers[1], swarm->particle_count);
+	}
+}
+
+/*
+ * Create the particles, and the engine which holds their vertices until the
+ * render thread realizes it. This can be run on any thread.
+ */
+static void create_state(struct particle_swarm *swarm)
+{
+	struct particle_swarm_priv *priv = swarm->priv;
+
+	priv->engine = particle_engine_new_deferred(swarm->particle_count,
+						    swarm->particle_size);
+
+	if (priv->snapshot)
+		restore_particles(swarm);
+	else
+		create_particles(swarm);
+}
+
+static gpointer prepare_thread_main(gpointer data)
+{
+	create_state(data);
+
+	return NULL;
+}
+
+static void create_resources(struct particle_swarm *swarm)
+{
+	struct particle_swarm_priv *priv = swarm->priv;
+
+	if (priv->prepare_thread) {
+		join_prepare_thread(swarm);
+	} else {
+		create_buffers(swarm);
+		create_state(swarm);
+	}
+
+	/* Only uploading the vertices needs the render thread. */
+	particle_engine_realize(priv->engine, priv->ctx, priv->fb);
+}
+
+void particle_swarm_prepare(struct particle_swarm *swarm)
+{
+	struct particle_swarm_priv *priv = swarm->priv;
+
+	/* Grouped swarms are created by their group */
+	g_return_if_fail(priv->group == NULL);
+
+	if (priv->prepare_thread || priv->engine)
+		return;
+
+	create_buffers(swarm);
+
+	priv->prepare_thread = g_thread_new("particle-swarm-prepare",
+					    prepare_thread_main, swarm);
+}
+
+/*
+ * Return the interval between ticks for the given time step.
+ */
+static float get_time_step(float time_step)
+{
+	return time_step > 0 ? time_step : DT;
+}
+
+/*
+ * Return the number of particles that the swarm's search structures are
+ * allocated for.
+ */
+static int get_capacity(struct particle_swarm *swarm)
+{
+	return MAX(swarm->priv->capacity, swarm->particle_count);
+}
+
+/*
+ * Fill in the interaction distances of the kernel parameters, which are the
+ * same for every particle.
+ */
+static void get_kernel_distances(struct particle_swarm *swarm,
+				 struct swarm_kernel_params *params)
+{
+	params->distance2 = swarm->particle_distance * swarm->particle_distance;
+
+	/* If we're using flocking behaviour, then we total up the velocity and
+	 * positions of any particles that are within the range of visibility of
+	 * the current particle, and are larger in size (alpha male
+	 * mentality). */
+	params->sight2 = swarm->type == SWARM_TYPE_FLOCK ?
+		swarm->particle_sight * swarm->particle_sight : 0;
+}
+
+/*
+ * Fill in the interaction kernel parameters for a particle.
+ */
+static void get_kernel_params(struct particle_swarm *swarm,
+			      const struct swarm_arrays *particles, int index,
+			      struct swarm_kernel_params *params)
+{
+	int i;
+
+	for (i = 0; i < 3; i++)
+		params->position[i] = particles->position[i][index];
+
+	params->size = particles->size[index];
+	get_kernel_distances(swarm, params);
+}
+
+/*
+ * Return whether some particles may reuse their neighbour sums from an earlier
+ * tick.
+ */
+static gboolean is_staggered(struct particle_swarm *swarm)
+{
+	return swarm->aggregate_interval > 1 || swarm->lod_band_count > 0;
+}
+
+/*
+ * Return whether the neighbour sums of every particle are accumulated at the
+ * start of a tick by accumulate_pairs(). The sums that a pair of particles
+ * adds to each particle may come from any worker, so the order that they are
+ * summed in depends on the number of workers.
+ */
+static gboolean uses_pair_sums(struct particle_swarm *swarm)
+{
+	return !is_staggered(swarm) && !swarm->reproducible &&
+		swarm->type != SWARM_TYPE_TOPOLOGICAL &&
+		(swarm->neighbour_search == SWARM_SEARCH_GRID ||
+		 swarm->neighbour_search == SWARM_SEARCH_BRUTE_FORCE);
+}
+
+/*
+ * Return the number of ticks between recomputing the neighbour sums of a
+ * particle at the given position.
+ */
+static int get_aggregate_interval(struct particle_swarm *swarm,
+				  const float *position)
+{
+	int interval = MAX(swarm->aggregate_interval, 1), i;
+	float d[3], distance2;
+
+	for (i = 0; i < 3; i++)
+		d[i] = position[i] - swarm->lod_viewpoint[i];
+
+	distance2 = d[0] * d[0] + d[1] * d[1] + d[2] * d[2];
+
+	for (i = 0; i < MIN(swarm->lod_band_count, SWARM_MAX_LOD_BANDS); i++) {
+		if (distance2 >= swarm->lod_bands[i].distance *
+		    swarm->lod_bands[i].distance)
+			interval = MAX(interval, swarm->lod_bands[i].interval);
+	}
+
+	return interval;
+}
+
+/*
+ * Copy the sums of the particle at index out of a set of sums.
+ */
+static void get_sums(const struct swarm_sums *all, int index,
+		     struct swarm_kernel_sums *sums)
+{
+	int i;
+
+	for (i = 0; i < 3; i++) {
+		sums->separation[i] = all->separation[i][index];
+		sums->position[i] = all->position[i][index];
+		sums->velocity[i] = all->velocity[i][index];
+	}
+
+	sums->flock_size = all->flock_size[index];
+}
+
+/*
+ * Copy the sums of the particle at index into a set of sums.
+ */
+static void set_sums(struct swarm_sums *all, int index,
+		     const struct swarm_kernel_sums *sums)
+{
+	int i;
+
+	for (i = 0; i < 3; i++) {
+		all->separation[i][index] = sums->separation[i];
+		all->position[i][index] = sums->position[i];
+		all->velocity[i][index] = sums->velocity[i];
+	}
+
+	all->flock_size[index] = sums->flock_size;
+}
+
+/*
+ * Whether the swarm reads it's neighbours from the compact copy of the sorted
+ * particles.
+ */
+static gboolean is_compact(struct particle_swarm *swarm)
+{
+	return swarm->compact_storage &&
+		swarm->neighbour_search == SWARM_SEARCH_GRID &&
+		swarm->type != SWARM_TYPE_TOPOLOGICAL;
+}
+
+/*
+ * Accumulate the influence of every particle in the cells surrounding a
+ * particle onto it's sums. The cells along the x axis are adjacent in memory,
+ * so each row of cells is visited as a single range.
+ */
+static void accumulate_grid(struct particle_swarm *swarm,
+			    const struct swarm_kernel_params *params,
+			    struct swarm_kernel_sums *sums)
+{
+	struct particle_swarm_priv *priv = swarm->priv;
+	const struct spatial_grid *grid = priv->grid;
+	struct swarm_kernel_params rounded;
+	int lo[3], hi[3], y, z;
+
+	spatial_grid_get_range(grid, params->position, priv->search_radius,
+			       lo, hi);
+
+	/* The particle's own entry in the compact copy must see the same
+	 * position and size as the particle, or it would influence itself. */
+	if (is_compact(swarm)) {
+		rounded = *params;
+		swarm_compact_round_params(&priv->sorted_compact, &rounded);
+		params = &rounded;
+	}
+
+	for (z = lo[2]; z <= hi[2]; z++) {
+		for (y = lo[1]; y <= hi[1]; y++) {
+			int start = grid->cell_start[spatial_grid_get_cell(grid, lo[0], y, z)];
+			int end = grid->cell_start[spatial_grid_get_cell(grid, hi[0], y, z) + 1];
+
+			if (is_compact(swarm))
+				swarm_kernel_accumulate_compact(&priv->sorted_compact,
+								start, end,
+								params, sums);
+			else
+				swarm_kernel_accumulate(&priv->sorted, start, end,
+							params, sums);
+		}
+	}
+}
+
+/*
+ * Accumulate the influence of the neighbours of the particle at index onto
+ * it's sums.
+ */
+static void get_neighbour_sums(struct particle_swarm *swarm, int index,
+			       struct swarm_kernel_sums *sums)
+{
+	struct particle_swarm_priv *priv = swarm->priv;
+	const struct swarm_arrays *particles = priv->particles;
+	float position[3];
+	int j;
+
+	for (j = 0; j < 3; j++)
+		position[j] = particles->position[j][index];
+
+	if (swarm->type == SWARM_TYPE_TOPOLOGICAL) {
+		const struct swarm_arrays *sorted = &priv->octree->sorted;
+		int nearest[SWARM_MAX_TOPOLOGICAL_NEIGHBOURS], count, k, s;
+		float nearest_distance2[SWARM_MAX_TOPOLOGICAL_NEIGHBOURS];
+		float distance2;
+
+		count = swarm_octree_find_nearest(priv->octree, index,
+						  CLAMP(swarm->topological_neighbours, 1,
+							SWARM_MAX_TOPOLOGICAL_NEIGHBOURS),
+						  nearest, nearest_distance2);
+
+		memset(sums, 0, sizeof(*sums));
+		distance2 = swarm->particle_distance * swarm->particle_distance;
+
+		/* Every neighbour counts towards the flock, whatever it's
+		 * size. */
+		for (k = 0; k < count; k++) {
+			float d[3];
+
+			s = nearest[k];
+
+			for (j = 0; j < 3; j++) {
+				d[j] = sorted->position[j][s] - position[j];
+				sums->position[j] += sorted->position[j][s];
+				sums->velocity[j] += sorted->velocity[j][s];
 			}
 
-			/* If we're using flocking behaviour, then we total up
-			 * the velocity and positions of any particles that are
-			 * within the range of visibility of the current
-			 * particle, and are larger in size (alpha male
-			 * mentality). */
-			if (swarm->type == SWARM_TYPE_FLOCK) {
-				if (distance < swarm->particle_sight &&
-				    other_particle->size > particle->size) {
-					struct particle *p = &priv->particles[i];
-
-					for (j = 0; j < 3; j++) {
-						center_of_mass[j] += pos[j];
-						velocity_avg[j] += p->velocity[j];
-					}
-
-					swarm_size++;
-				}
+			if (nearest_distance2[k] < distance2) {
+				for (j = 0; j < 3; j++)
+					sums->separation[j] += d[j];
 			}
 		}
+
+		sums->flock_size = count;
+	} else if (swarm->neighbour_search == SWARM_SEARCH_OCTREE) {
+		struct swarm_kernel_params params;
+
+		memset(sums, 0, sizeof(*sums));
+		get_kernel_params(swarm, particles, index, &params);
+		swarm_octree_accumulate(priv->octree, &params,
+					swarm->octree_theta, sums);
+	} else if (swarm->neighbour_search == SWARM_SEARCH_VERLET) {
+		struct swarm_kernel_params params;
+		int start = priv->neighbour_start[index];
+
+		memset(sums, 0, sizeof(*sums));
+		get_kernel_params(swarm, particles, index, &params);
+		swarm_kernel_accumulate_list(particles,
+					     &priv->neighbours[start],
+					     priv->neighbour_start[index + 1] - start,
+					     &params, sums);
+	} else if (!uses_pair_sums(swarm)) {
+		/* Either only some of the particles need their sums, so it is
+		 * cheaper to visit each pair twice than to visit every pair
+		 * once, or the swarm is reproducible, and each particle must
+		 * sum it's neighbours in a fixed order. */
+		struct swarm_kernel_params params;
+
+		memset(sums, 0, sizeof(*sums));
+		get_kernel_params(swarm, particles, index, &params);
+
+		if (swarm->neighbour_search == SWARM_SEARCH_GRID)
+			accumulate_grid(swarm, &params, sums);
+		else
+			swarm_kernel_accumulate(particles, 0,
+						swarm->particle_count,
+						&params, sums);
+	} else {
+		/* The sums of every particle were accumulated at the start of
+		 * the tick by accumulate_pairs(). */
+		get_sums(&priv->sums, index, sums);
+	}
+
+}
+
+static void particle_apply_swarming_behaviour(struct particle_swarm *swarm,
+					      int index, float *v)
+{
+	struct particle_swarm_priv *priv = swarm->priv;
+	const struct swarm_arrays *particles = priv->particles;
+	struct swarm_kernel_sums sums;
+	float position[3], velocity[3], center_of_mass[3], velocity_avg[3];
+	float swarm_size;
+	int i, j;
+
+	for (i = 0; i < 3; i++) {
+		position[i] = particles->position[i][index];
+		velocity[i] = particles->velocity[i][index];
+	}
+
+	if (is_staggered(swarm)) {
+		/* Only 1 in every interval particles recompute their sums each
+		 * tick, in turn. The rest reuse the sums that they last
+		 * computed. */
+		if (priv->aggregate_tick[index] >= 0 &&
+		    (index + priv->tick_count) %
+		    get_aggregate_interval(swarm, position)) {
+			get_sums(&priv->aggregate_sums, index, &sums);
+		} else {
+			get_neighbour_sums(swarm, index, &sums);
+			set_sums(&priv->aggregate_sums, index, &sums);
+			priv->aggregate_tick[index] = priv->tick_count;
+
+			for (i = 0; i < 3; i++)
+				priv->aggregate_positions[index * 3 + i] = position[i];
+		}
+	} else {
+		get_neighbour_sums(swarm, index, &sums);
+	}
+
+	swarm_size = sums.flock_size;
+
+	for (i = 0; i < 3; i++) {
+		/*
+		 * COLLISION AVOIDANCE
+		 *
+		 * Particles try to keep a small distance away from other
+		 * particles to prevent them bumping into each other and reduce
+		 * the density of the swarm:
+		 */
+		/* FIXME: is this correct? */
+		v[i] -= sums.separation[i] * priv->separation_accel;
+
+		center_of_mass[i] = sums.position[i];
+		velocity_avg[i] = sums.velocity[i];
 	}
 
 	/* Now we iterate through each of the three coordinate axis and apply
@@ -221,15 +990,16 @@ static void particle_apply_swarming_behaviour(struct particle_swarm *swarm,
 			 * of the swarm based on the properties of all of the
 			 * other particles: */
 			center_of_mass[i] = priv->position_sum[i] - position[i];
-			velocity_avg[i] = priv->velocity_sum[i] - particle->velocity[i];
+			velocity_avg[i] = priv->velocity_sum[i] - velocity[i];
 
 			swarm_size = swarm->particle_count - 1;
 			break;
 		case SWARM_TYPE_FLOCK:
+		case SWARM_TYPE_TOPOLOGICAL:
 		{
 			/* We must always have a flock to compare against, even
 			 * if a particle is on it's own: */
-			if (swarm_size < 1) {
+			if (swarm_size <= 0) {
 				for (j = 0; j < 3; j++) {
 					center_of_mass[j] = position[j];
 				}
@@ -263,7 +1033,7 @@ static void particle_apply_swarming_behaviour(struct particle_swarm *swarm,
 		 * creates a pattern of cohesive behaviour, with the swarm
 		 * moving in unison:
 		 */
-		v[i] += (velocity_avg[i] - particle->velocity[1]) *
+		v[i] += (velocity_avg[i] - velocity[1]) *
 			swarm->particle_velocity_consistency;
 
 		/*
@@ -278,132 +1048,1418 @@ static void particle_apply_swarming_behaviour(struct particle_swarm *swarm,
 		else if (position[i] > priv->boundary_max[i])
 			v[i] -= priv->boundary_accel;
 	}
+
+	/*
+	 * OBSTACLE AVOIDANCE
+	 *
+	 * Boids avoid obstacles in the same way, by being accelerated along the
+	 * gradient of the distance field, which points away from the nearest
+	 * surface:
+	 */
+	if (swarm->obstacles) {
+		float gradient[3], distance, length;
+
+		distance = distance_field_sample(swarm->obstacles, position,
+						 gradient);
+		length = sqrt(gradient[0] * gradient[0] +
+			      gradient[1] * gradient[1] +
+			      gradient[2] * gradient[2]);
+
+		if (distance < swarm->obstacle_threshold && length > 0) {
+			for (i = 0; i < 3; i++)
+				v[i] += gradient[i] / length * priv->obstacle_accel;
+		}
+	}
 }
 
 /*
- * TERMINAL VELOCITY
- *
- * Particles are rate limited so that their velocity can never exceed a certain
- * amount:
+ * Bin every particle into the spatial grid, and make a copy of the particles
+ * sorted by cell. Particles only read from the front buffer during a tick, so
+ * the grid stays valid until the buffers are swapped.
  */
-static float particle_enforce_speed_limit(struct particle_swarm_priv *priv,
-					  struct particle *particle)
+static void update_grid(struct particle_swarm *swarm, float radius)
 {
-	float speed, max_speed, min_speed;
-	float *v = &particle->velocity[0];
-	int i;
+	struct particle_swarm_priv *priv = swarm->priv;
+	struct spatial_grid *grid;
+	float min[3] = { 0 }, cell_size;
+	int i, j;
 
-	max_speed = priv->speed_limits.max / particle->size;
-	min_speed = priv->speed_limits.min / particle->size;
+	cell_size = radius * MAX(swarm->grid_cell_scale, 1);
 
-	speed = sqrt(v[0] * v[0] + v[1] * v[1] + v[2] * v[2]);
+	/* Create a new grid if the cell size has changed. */
+	if (!priv->grid || priv->grid_cell_size != cell_size) {
+		if (priv->grid)
+			spatial_grid_free(priv->grid);
 
-	if (speed > max_speed) {
-		for (i = 0; i < 3; i++) {
-			v[i] = (v[i] / speed) * max_speed;
-		}
-		speed = max_speed;
+		priv->grid = spatial_grid_new(min, priv->boundary, cell_size,
+					      MAX(get_capacity(swarm), 1) *
+					      GRID_CELLS_PER_PARTICLE);
+		priv->grid_cell_size = cell_size;
 	}
 
-	if (speed < min_speed) {
-		for (i = 0; i < 3; i++) {
-			v[i] = (v[i] / speed) * min_speed;
+	grid = priv->grid;
+
+	spatial_grid_clear(grid, swarm->particle_count);
+
+	for (i = 0; i < swarm->particle_count; i++) {
+		float position[3];
+
+		for (j = 0; j < 3; j++)
+			position[j] = priv->particles->position[j][i];
+
+		spatial_grid_insert(grid, i, position);
+	}
+
+	spatial_grid_commit(grid);
+
+	if (is_compact(swarm)) {
+		if (!priv->sorted_compact.data) {
+			float lo[3], hi[3];
+
+			for (j = 0; j < 3; j++) {
+				lo[j] = -priv->boundary[j] * COMPACT_MARGIN;
+				hi[j] = priv->boundary[j] * (1 + COMPACT_MARGIN);
+			}
+
+			swarm_compact_arrays_init(&priv->sorted_compact,
+						  get_capacity(swarm), lo, hi);
+		}
+
+		for (i = 0; i < swarm->particle_count; i++)
+			swarm_compact_arrays_set(&priv->sorted_compact, i,
+						 priv->particles,
+						 grid->indices[i]);
+		return;
+	}
+
+	if (!priv->sorted.data)
+		swarm_arrays_init(&priv->sorted, get_capacity(swarm));
+
+	for (i = 0; i < swarm->particle_count; i++) {
+		int index = grid->indices[i];
+
+		for (j = 0; j < 3; j++) {
+			priv->sorted.position[j][i] = priv->particles->position[j][index];
+			priv->sorted.velocity[j][i] = priv->particles->velocity[j][index];
+		}
+
+		priv->sorted.size[i] = priv->particles->size[index];
+	}
+}
+
+/*
+ * Fill in the interaction kernel parameters for the particle at index in the
+ * compact copy of the sorted particles.
+ */
+static void get_compact_kernel_params(struct particle_swarm *swarm, int index,
+				      struct swarm_kernel_params *params)
+{
+	float velocity[3];
+
+	swarm_compact_arrays_get(&swarm->priv->sorted_compact, index,
+				 params->position, velocity, &params->size);
+	get_kernel_distances(swarm, params);
+}
+
+/*
+ * Return the number of the particles which are visited by accumulate_pairs(),
+ * and write the ranges of particles that the particle at index in the sorted
+ * particles visits to ranges, as pairs of start and end.
+ *
+ * In SWARM_SEARCH_GRID swarms the particles are in cell order. Of the 27
+ * cells surrounding a particle, only the particle's own cell and the 13 cells
+ * which follow it in memory are visited, which leaves the other 13 to the
+ * particles within them. The cells are at least as large as the search
+ * radius, so every neighbour is within one cell of a particle.
+ */
+static int get_pair_ranges(struct particle_swarm *swarm, int index,
+			   const struct swarm_kernel_params *params,
+			   int ranges[PAIR_MAX_RANGES][2])
+{
+	struct spatial_grid *grid = swarm->priv->grid;
+	int c[3], lo, hi, y, z, count = 0;
+
+	for (y = 0; y < 3; y++)
+		c[y] = spatial_grid_get_coord(grid, y, params->position[y]);
+
+	lo = MAX(c[0] - 1, 0);
+	hi = MIN(c[0] + 1, grid->dims[0] - 1);
+
+	/* The rest of the particle's own cell, and the next cell along the
+	 * row */
+	ranges[count][0] = index + 1;
+	ranges[count++][1] = grid->cell_start[spatial_grid_get_cell(grid, hi, c[1], c[2]) + 1];
+
+	/* The next row of the same layer, and the three rows of the next
+	 * layer */
+	for (z = c[2]; z <= MIN(c[2] + 1, grid->dims[2] - 1); z++) {
+		for (y = z == c[2] ? c[1] + 1 : MAX(c[1] - 1, 0);
+		     y <= MIN(c[1] + 1, grid->dims[1] - 1); y++) {
+			ranges[count][0] = grid->cell_start[spatial_grid_get_cell(grid, lo, y, z)];
+			ranges[count++][1] = grid->cell_start[spatial_grid_get_cell(grid, hi, y, z) + 1];
+		}
+	}
+
+	return count;
+}
+
+/*
+ * Fill in the kernel parameters of the particle at index in the particles
+ * that accumulate_pairs() visits.
+ */
+static void get_pair_params(struct particle_swarm *swarm, int index,
+			    struct swarm_kernel_params *params)
+{
+	struct particle_swarm_priv *priv = swarm->priv;
+
+	if (swarm->neighbour_search != SWARM_SEARCH_GRID)
+		get_kernel_params(swarm, priv->particles, index, params);
+	else if (is_compact(swarm))
+		get_compact_kernel_params(swarm, index, params);
+	else
+		get_kernel_params(swarm, &priv->sorted, index, params);
+}
+
+/*
+ * Split the particles into blocks for accumulate_pairs(), and find the end of
+ * the window of sums of each block.
+ */
+static void set_pair_blocks(struct particle_swarm *swarm)
+{
+	struct particle_swarm_priv *priv = swarm->priv;
+	struct swarm_kernel_params params;
+	int ranges[PAIR_MAX_RANGES][2];
+	int worker_count = worker_pool_get_worker_count(priv->pool);
+	int block_count = worker_count > 1 ?
+		worker_count * PAIR_BLOCKS_PER_WORKER : 1;
+	int b, i, k, count, reach;
+
+	if (priv->pair_block_count != block_count) {
+		for (b = 0; b < priv->pair_block_count; b++)
+			swarm_sums_clear(&priv->pair_block_sums[b]);
+		g_free(priv->pair_block_sums);
+		g_free(priv->pair_block_start);
+		g_free(priv->pair_block_reach);
+
+		priv->pair_block_count = block_count;
+		priv->pair_block_sums = g_new0(struct swarm_sums, block_count);
+		priv->pair_block_start = g_new(int, block_count + 1);
+		priv->pair_block_reach = g_new(int, block_count);
+	}
+
+	for (b = 0; b <= block_count; b++)
+		priv->pair_block_start[b] = (gint64)swarm->particle_count * b /
+			block_count;
+
+	for (b = 0; b < block_count; b++) {
+		int start = priv->pair_block_start[b];
+		int end = priv->pair_block_start[b + 1];
+
+		/* Every following particle is visited without a grid. */
+		if (swarm->neighbour_search != SWARM_SEARCH_GRID) {
+			reach = start < end ? swarm->particle_count : start;
+		} else {
+			for (k = start, reach = end; k < end; k++) {
+				get_pair_params(swarm, k, &params);
+				count = get_pair_ranges(swarm, k, &params, ranges);
+
+				for (i = 0; i < count; i++)
+					reach = MAX(reach, ranges[i][1]);
+			}
+		}
+
+		priv->pair_block_reach[b] = reach;
+
+		/* The windows are zero outside of accumulate_pairs(), so they
+		 * can be reallocated freely. */
+		if (priv->pair_block_sums[b].capacity < reach - start) {
+			swarm_sums_clear(&priv->pair_block_sums[b]);
+			swarm_sums_init(&priv->pair_block_sums[b],
+					reach - start + (reach - start) / 4);
+		}
+	}
+}
+
+/*
+ * Point a set of particle arrays at the range of particle_count particles
+ * starting at offset in a larger set, such as a group's arrays or the shared
+ * arrays of a divided swarm.
+ */
+static void get_arrays_range(struct swarm_arrays *arrays,
+			     const struct swarm_arrays *source,
+			     int offset, int particle_count)
+{
+	int i;
+
+	for (i = 0; i < 3; i++) {
+		arrays->position[i] = source->position[i] + offset;
+		arrays->velocity[i] = source->velocity[i] + offset;
+	}
+
+	arrays->speed = source->speed + offset;
+	arrays->size = source->size + offset;
+	arrays->capacity = particle_count;
+
+	/* The storage belongs to the larger set. */
+	arrays->data = NULL;
+}
+
+/*
+ * The same as get_arrays_range(), but for compact arrays.
+ */
+static void get_compact_arrays_range(struct swarm_compact_arrays *arrays,
+				     const struct swarm_compact_arrays *source,
+				     int offset, int particle_count)
+{
+	int i;
+
+	*arrays = *source;
+
+	for (i = 0; i < 3; i++) {
+		arrays->position[i] = source->position[i] + offset;
+		arrays->velocity[i] = source->velocity[i] + offset;
+	}
+
+	arrays->size = source->size + offset;
+	arrays->capacity = particle_count;
+
+	/* The storage belongs to the larger set. */
+	arrays->data = NULL;
+}
+
+/*
+ * Accumulate the interactions of each particle in a block with every
+ * neighbour that follows it, into the block's window of sums. The kernels
+ * index the window from the start of the block, so they are given the
+ * particles from the start of the block on.
+ */
+static void accumulate_pairs(gpointer data, int start, int end, int worker)
+{
+	struct particle_swarm *swarm = data;
+	struct particle_swarm_priv *priv = swarm->priv;
+	struct swarm_kernel_params params;
+	struct swarm_compact_arrays compact;
+	struct swarm_arrays arrays;
+	struct swarm_sums *sums;
+	int ranges[PAIR_MAX_RANGES][2];
+	int b, i, k, count, offset;
+
+	(void)worker;
+
+	for (b = start; b < end; b++) {
+		offset = priv->pair_block_start[b];
+		sums = &priv->pair_block_sums[b];
+
+		if (swarm->neighbour_search != SWARM_SEARCH_GRID)
+			get_arrays_range(&arrays, priv->particles, offset,
+					 swarm->particle_count - offset);
+		else if (is_compact(swarm))
+			get_compact_arrays_range(&compact,
+						 &priv->sorted_compact, offset,
+						 swarm->particle_count - offset);
+		else
+			get_arrays_range(&arrays, &priv->sorted, offset,
+					 swarm->particle_count - offset);
+
+		for (k = priv->pair_block_start[b];
+		     k < priv->pair_block_start[b + 1]; k++) {
+			get_pair_params(swarm, k, &params);
+
+			/* Visit every following particle */
+			if (swarm->neighbour_search != SWARM_SEARCH_GRID) {
+				swarm_kernel_accumulate_pairs(&arrays, k - offset,
+							      k + 1 - offset,
+							      swarm->particle_count - offset,
+							      &params, sums);
+				continue;
+			}
+
+			count = get_pair_ranges(swarm, k, &params, ranges);
+
+			for (i = 0; i < count; i++) {
+				if (is_compact(swarm))
+					swarm_kernel_accumulate_pairs_compact(&compact,
+									      k - offset,
+									      ranges[i][0] - offset,
+									      ranges[i][1] - offset,
+									      &params, sums);
+				else
+					swarm_kernel_accumulate_pairs(&arrays, k - offset,
+								      ranges[i][0] - offset,
+								      ranges[i][1] - offset,
+								      &params, sums);
+			}
+		}
+	}
+}
+
+/*
+ * Sum the windows of every block into the sums of the particles in the range
+ * [start, end), and zero them ready for the next tick.
+ */
+static void reduce_sums(gpointer data, int start, int end, int worker)
+{
+	struct particle_swarm *swarm = data;
+	struct particle_swarm_priv *priv = swarm->priv;
+	struct swarm_sums *sums = &priv->sums;
+	int b, k, j, first, last, offset, index;
+
+	(void)worker;
+
+	for (k = start; k < end; k++) {
+		/* Grid sums are in cell order */
+		index = swarm->neighbour_search == SWARM_SEARCH_GRID ?
+			priv->grid->indices[k] : k;
+
+		for (j = 0; j < 3; j++) {
+			sums->separation[j][index] = 0;
+			sums->position[j][index] = 0;
+			sums->velocity[j][index] = 0;
+		}
+
+		sums->flock_size[index] = 0;
+	}
+
+	/* The blocks are in order, so only those which start before the end
+	 * of the range can overlap it. */
+	for (b = 0; b < priv->pair_block_count &&
+		     priv->pair_block_start[b] < end; b++) {
+		struct swarm_sums *s = &priv->pair_block_sums[b];
+
+		offset = priv->pair_block_start[b];
+		first = MAX(start, offset);
+		last = MIN(end, priv->pair_block_reach[b]);
+
+		for (k = first; k < last; k++) {
+			index = swarm->neighbour_search == SWARM_SEARCH_GRID ?
+				priv->grid->indices[k] : k;
+
+			for (j = 0; j < 3; j++) {
+				sums->separation[j][index] += s->separation[j][k - offset];
+				sums->position[j][index] += s->position[j][k - offset];
+				sums->velocity[j][index] += s->velocity[j][k - offset];
+				s->separation[j][k - offset] = 0;
+				s->position[j][k - offset] = 0;
+				s->velocity[j][k - offset] = 0;
+			}
+
+			sums->flock_size[index] += s->flock_size[k - offset];
+			s->flock_size[k - offset] = 0;
+		}
+	}
+}
+
+/*
+ * Find the particles within the neighbour list radius of particle i, using the
+ * grid. If neighbours is not NULL, then the neighbours are written to it.
+ * Returns the number of neighbours.
+ */
+static int find_neighbours(struct particle_swarm *swarm, int i, int *neighbours)
+{
+	struct particle_swarm_priv *priv = swarm->priv;
+	struct spatial_grid *grid = priv->grid;
+	const struct swarm_arrays *sorted = &priv->sorted;
+	float position[3], radius2;
+	int lo[3], hi[3], count = 0, j, k, y, z;
+
+	for (j = 0; j < 3; j++)
+		position[j] = priv->particles->position[j][i];
+
+	radius2 = priv->neighbour_radius * priv->neighbour_radius;
+
+	spatial_grid_get_range(grid, position, priv->neighbour_radius, lo, hi);
+
+	for (z = lo[2]; z <= hi[2]; z++) {
+		for (y = lo[1]; y <= hi[1]; y++) {
+			int end = grid->cell_start[spatial_grid_get_cell(grid, hi[0], y, z) + 1];
+
+			for (k = grid->cell_start[spatial_grid_get_cell(grid, lo[0], y, z)];
+			     k < end; k++) {
+				float dx = sorted->position[0][k] - position[0];
+				float dy = sorted->position[1][k] - position[1];
+				float dz = sorted->position[2][k] - position[2];
+
+				if (grid->indices[k] == i ||
+				    dx * dx + dy * dy + dz * dz >= radius2)
+					continue;
+
+				if (neighbours)
+					neighbours[count] = grid->indices[k];
+				count++;
+			}
+		}
+	}
+
+	return count;
+}
+
+static void count_neighbours(gpointer data, int start, int end, int worker)
+{
+	struct particle_swarm *swarm = data;
+	int i;
+
+	(void)worker;
+
+	for (i = start; i < end; i++)
+		swarm->priv->neighbour_start[i + 1] = find_neighbours(swarm, i, NULL);
+}
+
+static void fill_neighbours(gpointer data, int start, int end, int worker)
+{
+	struct particle_swarm *swarm = data;
+	struct particle_swarm_priv *priv = swarm->priv;
+	int i;
+
+	(void)worker;
+
+	for (i = start; i < end; i++)
+		find_neighbours(swarm, i,
+				&priv->neighbours[priv->neighbour_start[i]]);
+}
+
+/*
+ * Rebuild the neighbour lists of a SWARM_SEARCH_VERLET swarm if they are out
+ * of date. A particle which is not in another particle's list is further away
+ * than the search radius plus the skin, so the lists stay valid until the
+ * particles have moved half of the skin closer to each-other.
+ */
+static void update_neighbour_lists(struct particle_swarm *swarm)
+{
+	struct particle_swarm_priv *priv = swarm->priv;
+	const struct swarm_arrays *particles = priv->particles;
+	float radius = priv->search_radius + MAX(swarm->verlet_skin, 0);
+	int i, j, count;
+
+	if (!priv->neighbour_start) {
+		priv->neighbour_start = g_new0(int, get_capacity(swarm) + 1);
+		priv->neighbour_positions = g_new(float,
+						  get_capacity(swarm) * 3);
+	}
+
+	if (priv->neighbour_radius == radius) {
+		float max_distance2 = 0, limit = MAX(swarm->verlet_skin, 0) / 2;
+
+		for (i = 0; i < swarm->particle_count; i++) {
+			const float *p = &priv->neighbour_positions[i * 3];
+			float d2 = 0;
+
+			for (j = 0; j < 3; j++) {
+				float d = particles->position[j][i] - p[j];
+
+				d2 += d * d;
+			}
+
+			max_distance2 = MAX(max_distance2, d2);
+		}
+
+		if (max_distance2 <= limit * limit)
+			return;
+	}
+
+	priv->neighbour_radius = radius;
+	update_grid(swarm, radius);
+
+	/* Count the neighbours of each particle, and then convert the counts
+	 * into offsets so that the lists can be filled in parallel. */
+	worker_pool_run(priv->pool, swarm->particle_count,
+			count_neighbours, swarm);
+
+	for (i = 0, count = 0; i < swarm->particle_count; i++) {
+		int n = priv->neighbour_start[i + 1];
+
+		priv->neighbour_start[i] = count;
+		count += n;
+	}
+
+	priv->neighbour_start[swarm->particle_count] = count;
+
+	if (count > priv->neighbour_capacity) {
+		priv->neighbour_capacity = MAX(count, priv->neighbour_capacity * 2);
+		g_free(priv->neighbours);
+		priv->neighbours = g_new(int, priv->neighbour_capacity);
+	}
+
+	worker_pool_run(priv->pool, swarm->particle_count,
+			fill_neighbours, swarm);
+
+	for (i = 0; i < swarm->particle_count; i++) {
+		for (j = 0; j < 3; j++)
+			priv->neighbour_positions[i * 3 + j] = particles->position[j][i];
+	}
+
+	priv->stats.neighbour_list_rebuilds++;
+	priv->stats.neighbour_list_length = (float)count /
+		MAX(swarm->particle_count, 1);
+}
+
+/*
+ * Force every particle to recompute it's cached neighbour sums on the next
+ * tick.
+ */
+static void invalidate_aggregates(struct particle_swarm *swarm)
+{
+	struct particle_swarm_priv *priv = swarm->priv;
+	int i;
+
+	if (!priv->aggregate_tick)
+		return;
+
+	for (i = 0; i < swarm->particle_count; i++)
+		priv->aggregate_tick[i] = -1;
+}
+
+/*
+ * Measure how stale the cached neighbour sums are.
+ */
+static void update_aggregate_stats(struct particle_swarm *swarm)
+{
+	struct particle_swarm_priv *priv = swarm->priv;
+	const struct swarm_arrays *particles = priv->particles;
+	float age = 0, drift = 0, max_drift = 0;
+	int i, j;
+
+	for (i = 0; i < swarm->particle_count; i++) {
+		const float *p = &priv->aggregate_positions[i * 3];
+		float d2 = 0, d;
+
+		for (j = 0; j < 3; j++) {
+			d = particles->position[j][i] - p[j];
+			d2 += d * d;
+		}
+
+		d = sqrt(d2);
+		age += priv->tick_count - priv->aggregate_tick[i];
+		drift += d;
+		max_drift = MAX(max_drift, d);
+	}
+
+	priv->stats.aggregate_age = age / MAX(swarm->particle_count, 1);
+	priv->stats.aggregate_drift = drift / MAX(swarm->particle_count, 1);
+	priv->stats.aggregate_max_drift = max_drift;
+}
+
+/*
+ * Allocate the scratch space used to reorder the particles.
+ */
+static void alloc_reorder(struct particle_swarm *swarm)
+{
+	struct particle_swarm_priv *priv = swarm->priv;
+
+	if (priv->reorder_codes)
+		return;
+
+	priv->reorder_codes = g_new(guint32, swarm->particle_count);
+	priv->reorder_indices = g_new(int, swarm->particle_count);
+	priv->reorder_scratch_codes = g_new(guint32, swarm->particle_count);
+	priv->reorder_scratch_indices = g_new(int, swarm->particle_count);
+	priv->reorder_colors = g_new(CoglColor, swarm->particle_count);
+}
+
+/*
+ * Move the particle at reorder_indices[i] to i, for every particle. The
+ * particle state and the engine's vertices are permuted together, so a
+ * particle keeps it's color.
+ */
+static void permute_particles(struct particle_swarm *swarm)
+{
+	struct particle_swarm_priv *priv = swarm->priv;
+	struct particle_engine *engine = priv->engine;
+	const struct swarm_arrays *particles = priv->particles;
+	struct swarm_arrays *next = priv->next_particles;
+	int i, j;
+
+	/* Gather the particles into the back buffer, and swap it to the
+	 * front. */
+	for (i = 0; i < swarm->particle_count; i++) {
+		int index = priv->reorder_indices[i];
+
+		for (j = 0; j < 3; j++) {
+			next->position[j][i] = particles->position[j][index];
+			next->velocity[j][i] = particles->velocity[j][index];
+		}
+
+		next->speed[i] = particles->speed[index];
+		next->size[i] = particles->size[index];
+	}
+
+	priv->particles = next;
+	priv->next_particles = (struct swarm_arrays *)particles;
+
+	/* Permute the vertex colors to match. The positions are written at the
+	 * end of the tick. A group maps it's engine's buffer for the whole
+	 * tick. */
+	if (!priv->group)
+		particle_engine_push_buffer(engine,
+					    COGL_BUFFER_ACCESS_READ_WRITE, 0);
+
+	for (i = 0; i < swarm->particle_count; i++)
+		priv->reorder_colors[i] = *particle_engine_get_particle_color(engine,
+									      priv->particle_offset + i);
+
+	for (i = 0; i < swarm->particle_count; i++)
+		*particle_engine_get_particle_color(engine, priv->particle_offset + i) =
+			priv->reorder_colors[priv->reorder_indices[i]];
+
+	if (!priv->group)
+		particle_engine_pop_buffer(engine);
+
+	/* The neighbour lists and cached sums refer to particles by index. */
+	priv->neighbour_radius = 0;
+	invalidate_aggregates(swarm);
+}
+
+/*
+ * Sort the particles along a Morton curve, so that particles which are close
+ * together in space are close together in memory.
+ */
+static void reorder_particles(struct particle_swarm *swarm)
+{
+	struct particle_swarm_priv *priv = swarm->priv;
+	const struct swarm_arrays *particles = priv->particles;
+	float min[3] = { 0 };
+	double start = g_timer_elapsed(priv->timer, NULL);
+	int i, j;
+
+	alloc_reorder(swarm);
+
+	for (i = 0; i < swarm->particle_count; i++) {
+		float position[3];
+
+		for (j = 0; j < 3; j++)
+			position[j] = particles->position[j][i];
+
+		priv->reorder_codes[i] = morton_encode(position, min,
+						       priv->boundary);
+		priv->reorder_indices[i] = i;
+	}
+
+	morton_sort(priv->reorder_codes, priv->reorder_indices,
+		    swarm->particle_count, priv->reorder_scratch_codes,
+		    priv->reorder_scratch_indices);
+
+	permute_particles(swarm);
+
+	priv->stats.reorders++;
+	priv->stats.reorder_time += g_timer_elapsed(priv->timer, NULL) - start;
+}
+
+/*
+ * TERMINAL VELOCITY
+ *
+ * Particles are rate limited so that their velocity can never exceed a certain
+ * amount:
+ */
+static float particle_enforce_speed_limit(struct particle_swarm_priv *priv,
+					  float *v, float size)
+{
+	float speed, max_speed, min_speed;
+	int i;
+
+	max_speed = priv->speed_limits.max / size;
+	min_speed = priv->speed_limits.min / size;
+
+	speed = sqrt(v[0] * v[0] + v[1] * v[1] + v[2] * v[2]);
+
+	if (speed > max_speed) {
+		for (i = 0; i < 3; i++) {
+			v[i] = (v[i] / speed) * max_speed;
+		}
+		speed = max_speed;
+	}
+
+	if (speed < min_speed) {
+		for (i = 0; i < 3; i++) {
+			v[i] = (v[i] / speed) * min_speed;
 		}
 		speed = min_speed;
 	}
 
-	return speed;
+	return speed;
+}
+
+static void update_particle(struct particle_swarm *swarm,
+			    int index, float tick_time)
+{
+	struct particle_swarm_priv *priv = swarm->priv;
+	const struct swarm_arrays *particles = priv->particles;
+	struct swarm_arrays *next = priv->next_particles;
+	float velocity[3], dv[3] = { 0 }; /* Change in velocity */
+	float size = particles->size[index];
+	unsigned int i;
+
+	/* Apply the rules of particle behaviour */
+	particle_apply_swarming_behaviour(swarm, index, &dv[0]);
+
+	for (i = 0; i < 3; i++) {
+		/* Apply global force */
+		dv[i] += priv->global_accel[i] * tick_time;
+
+		/* Apply the velocity change to the position */
+		velocity[i] = particles->velocity[i][index] +
+			dv[i] * particles->speed[index] * swarm->agility;
+	}
+
+	/* Limit the rate of particle movement */
+	next->speed[index] = particle_enforce_speed_limit(priv, velocity, size);
+	next->size[index] = size;
+
+	/* Update position */
+	for (i = 0; i < 3; i++) {
+		next->velocity[i][index] = velocity[i];
+		next->position[i][index] = particles->position[i][index] +
+			velocity[i];
+	}
+}
+
+/*
+ * Update the particles in the range [start, end) of the particles that the
+ * tick updates.
+ */
+static void update_particles(gpointer data, int start, int end, int worker)
+{
+	struct particle_swarm *swarm = data;
+	struct particle_swarm_priv *priv = swarm->priv;
+	int i;
+
+	(void)worker;
+
+	for (i = priv->update_start + start; i < priv->update_start + end; i++)
+		update_particle(swarm, i, priv->dt);
+}
+
+/*
+ * Move every particle to it's current position in the query index.
+ */
+static void update_index(struct particle_swarm *swarm)
+{
+	struct particle_swarm_priv *priv = swarm->priv;
+	int i, j;
+
+	for (i = 0; i < swarm->particle_count; i++) {
+		float position[3];
+
+		for (j = 0; j < 3; j++)
+			position[j] = priv->particles->position[j][i];
+
+		particle_index_update(priv->index, i, position);
+	}
+}
+
+/*
+ * Sum the velocities and positions of the particles in each block in the
+ * range [start, end), in order.
+ */
+static void sum_hive_blocks(gpointer data, int start, int end, int worker)
+{
+	struct particle_swarm *swarm = data;
+	struct particle_swarm_priv *priv = swarm->priv;
+	const struct swarm_arrays *particles = priv->particles;
+	int b, i, j;
+
+	(void)worker;
+
+	for (b = start; b < end; b++) {
+		float *sums = &priv->hive_block_sums[b * 6];
+		int last = MIN((b + 1) * HIVE_BLOCK_SIZE, swarm->particle_count);
+
+		memset(sums, 0, sizeof(float) * 6);
+
+		for (i = b * HIVE_BLOCK_SIZE; i < last; i++) {
+			for (j = 0; j < 3; j++) {
+				sums[j] += particles->velocity[j][i];
+				sums[3 + j] += particles->position[j][i];
+			}
+		}
+	}
+}
+
+/*
+ * Rebuild the octree from the current particles.
+ */
+static void update_octree(struct particle_swarm *swarm)
+{
+	struct particle_swarm_priv *priv = swarm->priv;
+	float min[3] = { 0 }, size[3];
+	int j;
+
+	if (!priv->octree)
+		priv->octree = swarm_octree_new(get_capacity(swarm));
+
+	/* The octants are cubes, so that a leaf's particles are spread
+	 * evenly around it's center however flat the swarm is. */
+	size[0] = MAX(MAX(priv->boundary[0], priv->boundary[1]),
+		      priv->boundary[2]);
+	for (j = 1; j < 3; j++)
+		size[j] = size[0];
+
+	swarm_octree_build(priv->octree, priv->particles,
+			   swarm->particle_count, min, size);
+}
+
+/*
+ * Update the particles of the swarm, which must not be divided, from the
+ * front buffer into the back buffer.
+ */
+static void tick_particles(struct particle_swarm *swarm)
+{
+	struct particle_swarm_priv *priv = swarm->priv;
+
+	if (swarm->reorder_interval > 0 &&
+	    ++priv->ticks_since_reorder >= swarm->reorder_interval) {
+		reorder_particles(swarm);
+		priv->ticks_since_reorder = 0;
+	}
+
+	/* Topological swarms find their nearest neighbours with the octree,
+	 * whatever the search method. */
+	if (swarm->type == SWARM_TYPE_TOPOLOGICAL)
+		update_octree(swarm);
+	else switch (swarm->neighbour_search) {
+	case SWARM_SEARCH_GRID:
+		update_grid(swarm, priv->search_radius);
+		break;
+	case SWARM_SEARCH_VERLET:
+		update_neighbour_lists(swarm);
+		break;
+	case SWARM_SEARCH_OCTREE:
+		update_octree(swarm);
+		break;
+	default:
+		break;
+	}
+
+	if (is_staggered(swarm) && !priv->aggregate_tick) {
+		swarm_sums_init(&priv->aggregate_sums, swarm->particle_count);
+		priv->aggregate_tick = g_new(int, swarm->particle_count);
+		priv->aggregate_positions = g_new(float,
+						  swarm->particle_count * 3);
+		invalidate_aggregates(swarm);
+	}
+
+	/* Accumulate the interactions between every pair of neighbours. */
+	if (uses_pair_sums(swarm)) {
+		if (!priv->sums.data)
+			swarm_sums_init(&priv->sums, get_capacity(swarm));
+
+		set_pair_blocks(swarm);
+
+		worker_pool_run_chunks(priv->pool, priv->pair_block_count, 1,
+				       accumulate_pairs, swarm);
+		worker_pool_run(priv->pool, swarm->particle_count,
+				reduce_sums, swarm);
+	}
+
+	/* Iterate over every particle and update them. A slab only updates
+	 * the particles that it owns. */
+	if (!priv->is_slab) {
+		priv->update_start = 0;
+		priv->update_end = swarm->particle_count;
+	}
+
+	worker_pool_run(priv->pool, priv->update_end - priv->update_start,
+			update_particles, swarm);
+}
+
+static void tick(struct particle_swarm *swarm);
+
+/*
+ * Tick the slab of the given process in a divided swarm, using the process's
+ * own copy of the slab swarm. The slab's buffers are views of the shared
+ * buffers, starting at it's first ghost.
+ */
+static void tick_slab(gpointer data, int process)
+{
+	const struct slab_state *state = data;
+	const struct slab *slab = &state->slabs[process];
+	struct particle_swarm *local = state->slab;
+	struct particle_swarm_priv *local_priv = local->priv;
+	int count = slab->ghost_end - slab->ghost_start, j;
+
+	if (slab->owned_start == slab->owned_end)
+		return;
+
+	/* The slab only needs the particles in it's range, and it's order
+	 * is decided by the coordinator. */
+	*local = state->config;
+	local->priv = local_priv;
+	local->particle_count = count;
+	local->process_count = 1;
+	local->reorder_interval = 0;
+	local->aggregate_interval = 0;
+	local->lod_band_count = 0;
+	local->autotune = FALSE;
+
+	get_arrays_range(&local_priv->buffers[0],
+			 &state->buffers[state->front],
+			 slab->ghost_start, count);
+	get_arrays_range(&local_priv->buffers[1],
+			 &state->buffers[!state->front],
+			 slab->ghost_start, count);
+	local_priv->particles = &local_priv->buffers[0];
+	local_priv->next_particles = &local_priv->buffers[1];
+	local_priv->update_start = slab->owned_start - slab->ghost_start;
+	local_priv->update_end = slab->owned_end - slab->ghost_start;
+
+	for (j = 0; j < 3; j++) {
+		local_priv->velocity_sum[j] = state->velocity_sum[j];
+		local_priv->position_sum[j] = state->position_sum[j];
+	}
+
+	update_boundaries(local);
+
+	/* Particles move between slabs, so the neighbour lists of a
+	 * SWARM_SEARCH_VERLET slab are rebuilt every tick. */
+	local_priv->neighbour_radius = 0;
+
+	tick(local);
+}
+
+/*
+ * Return the index of the first of the sorted band codes which is not less
+ * than band.
+ */
+static int find_band(const guint32 *codes, int count, guint32 band)
+{
+	int lo = 0, hi = count;
+
+	while (lo < hi) {
+		int mid = lo + (hi - lo) / 2;
+
+		if (codes[mid] < band)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return lo;
+}
+
+/*
+ * Return the band along the x axis of the particle at index.
+ */
+static int get_band(const struct swarm_arrays *particles, int index,
+		    float width, int band_count)
+{
+	return CLAMP(floor(particles->position[0][index] / width),
+		     0, band_count - 1);
+}
+
+/*
+ * Return whether every particle of a divided swarm is within SLAB_SLACK bands
+ * of the band that it was last sorted into.
+ */
+static gboolean slabs_are_valid(struct particle_swarm *swarm, float width,
+				int band_count)
+{
+	struct particle_swarm_priv *priv = swarm->priv;
+	int i;
+
+	if (priv->band_width != width || priv->band_count != band_count)
+		return FALSE;
+
+	for (i = 0; i < swarm->particle_count; i++) {
+		int band = get_band(priv->particles, i, width, band_count);
+
+		if (ABS(band - (int)priv->reorder_codes[i]) > SLAB_SLACK)
+			return FALSE;
+	}
+
+	return TRUE;
+}
+
+/*
+ * Sort the particles of a divided swarm into bands, and share them out
+ * between the processes as slabs.
+ */
+static void sort_slabs(struct particle_swarm *swarm, float width,
+		       int band_count)
+{
+	struct particle_swarm_priv *priv = swarm->priv;
+	struct slab_state *state = priv->shared;
+	int process_count = process_pool_get_process_count(priv->processes);
+	int count = swarm->particle_count, p, i;
+	const guint32 *codes;
+	gboolean sorted = TRUE;
+
+	alloc_reorder(swarm);
+	codes = priv->reorder_codes;
+
+	for (i = 0; i < count; i++) {
+		priv->reorder_codes[i] = get_band(priv->particles, i, width,
+						  band_count);
+		priv->reorder_indices[i] = i;
+	}
+
+	morton_sort(priv->reorder_codes, priv->reorder_indices, count,
+		    priv->reorder_scratch_codes, priv->reorder_scratch_indices);
+
+	for (i = 0; i < count && sorted; i++)
+		sorted = priv->reorder_indices[i] == i;
+
+	if (!sorted)
+		permute_particles(swarm);
+
+	priv->band_width = width;
+	priv->band_count = band_count;
+
+	for (p = 0; p < process_count; p++) {
+		struct slab *slab = &state->slabs[p];
+		int target = (gint64)count * (p + 1) / process_count;
+		guint32 first, last;
+
+		/* Slabs end on the band boundary nearest to an even share of
+		 * the particles. */
+		slab->owned_start = p > 0 ? state->slabs[p - 1].owned_end : 0;
+		slab->owned_end = target < count ?
+			find_band(codes, count, codes[target]) : count;
+		slab->owned_end = MAX(slab->owned_end, slab->owned_start);
+
+		if (slab->owned_start == slab->owned_end) {
+			slab->ghost_start = slab->ghost_end = slab->owned_start;
+			continue;
+		}
+
+		/* A neighbour is at most one band away, and either of the
+		 * pair may have moved SLAB_SLACK bands since the sort. */
+		first = codes[slab->owned_start];
+		last = codes[slab->owned_end - 1];
+
+		slab->ghost_start = first > 1 + 2 * SLAB_SLACK ?
+			find_band(codes, count, first - 1 - 2 * SLAB_SLACK) : 0;
+		slab->ghost_end = find_band(codes, count,
+					    last + 2 + 2 * SLAB_SLACK);
+	}
+}
+
+/*
+ * Tick a divided swarm. The particles are sorted into bands along the x axis
+ * which are as wide as the search radius, so that every neighbour of a
+ * particle is in the same band or an adjacent one. The bands are then shared
+ * out between the processes as slabs with similar numbers of particles, and
+ * each process updates the particles of it's slab, seeing the particles in
+ * the nearby bands on either side as ghosts.
+ *
+ * Sorting and permuting the particles is serial, so rather than sorting them
+ * every tick, each slab keeps the particles that it owns until one of the
+ * particles has moved more than SLAB_SLACK bands, which takes many ticks.
+ * Only then are they sorted again and the slabs rebalanced.
+ */
+static void tick_slabs(struct particle_swarm *swarm)
+{
+	struct particle_swarm_priv *priv = swarm->priv;
+	struct slab_state *state = priv->shared;
+	float width = MAX(priv->search_radius, 1);
+	int band_count, j;
+
+	band_count = MAX((int)ceil(priv->boundary[0] / width), 1);
+
+	if (!slabs_are_valid(swarm, width, band_count))
+		sort_slabs(swarm, width, band_count);
+
+	state->config = *swarm;
+	state->front = priv->particles == &priv->buffers[1];
+
+	for (j = 0; j < 3; j++) {
+		state->velocity_sum[j] = priv->velocity_sum[j];
+		state->position_sum[j] = priv->position_sum[j];
+	}
+
+	process_pool_run(priv->processes, tick_slab, state);
 }
 
-static void update_particle(struct particle_swarm *swarm,
-			    int index, float tick_time)
+static void log_tuner(const char *message, gpointer data)
+{
+	struct particle_swarm *swarm = data;
+
+	if (swarm->autotune_log)
+		swarm->autotune_log(swarm, message, swarm->autotune_log_data);
+}
+
+/*
+ * Offer a parameter to the tuner, starting from it's current value.
+ */
+static void add_tuned_parameter(struct particle_swarm *swarm, int parameter,
+				const char *name, float current,
+				const float *values, int count)
 {
 	struct particle_swarm_priv *priv = swarm->priv;
-	struct particle *particle = &priv->particles[index];
-	float *position, dv[3] = { 0 }; /* Change in velocity */
-	unsigned int i;
+	float candidates[SWARM_TUNER_MAX_VALUES];
 
-	position = particle_engine_get_particle_position(priv->engine, index);
+	candidates[0] = current;
+	memcpy(&candidates[1], values,
+	       sizeof(float) * MIN(count, SWARM_TUNER_MAX_VALUES - 1));
 
-	/* Apply the rules of particle behaviour */
-	particle_apply_swarming_behaviour(swarm, index, &dv[0]);
+	priv->tune_parameters[parameter] =
+		swarm_tuner_add_parameter(priv->tuner, name, candidates,
+					  MIN(count + 1, SWARM_TUNER_MAX_VALUES));
+}
 
-	for (i = 0; i < 3; i++) {
-		/* Apply global force */
-		dv[i] += priv->global_accel[i] * tick_time;
+/*
+ * Return the least number of ticks that the neighbour lists of a
+ * SWARM_SEARCH_VERLET swarm with the given skin last between rebuilds, as the
+ * smallest particles move the furthest each tick.
+ */
+static int get_rebuild_period(struct particle_swarm *swarm, float skin)
+{
+	float distance = swarm->speed_limits.max *
+		get_time_step(swarm->time_step) / SWARM_MIN_PARTICLE_SIZE;
 
-		/* Apply the velocity change to the position */
-		particle->velocity[i] += dv[i] * particle->speed * swarm->agility;
+	if (distance <= 0)
+		return 0;
+
+	return MIN(ceil(skin / 2 / distance), G_MAXINT / 2);
+}
+
+/*
+ * Create the tuner, with candidate values for the parameters which affect the
+ * swarm's neighbour search.
+ */
+static void create_tuner(struct particle_swarm *swarm)
+{
+	struct particle_swarm_priv *priv = swarm->priv;
+	float threads[SWARM_TUNER_MAX_VALUES - 1];
+	int processors = g_get_num_processors(), count = 0;
+	unsigned int i;
+	gboolean uses_grid;
+
+	priv->tuner = swarm_tuner_new(swarm->autotune_threshold > 0 ?
+				      swarm->autotune_threshold :
+				      AUTOTUNE_THRESHOLD,
+				      log_tuner, swarm);
+
+	for (i = 0; i < TUNE_PARAMETER_COUNT; i++)
+		priv->tune_parameters[i] = -1;
+
+	/* Powers of two up to the number of processors, and the number of
+	 * processors itself. */
+	for (i = 1; (int)i < processors &&
+		     count < (int)G_N_ELEMENTS(threads) - 1; i *= 2)
+		threads[count++] = i;
+	threads[count++] = processors;
+
+	add_tuned_parameter(swarm, TUNE_THREAD_COUNT, "thread_count",
+			    MAX(swarm->thread_count, 1), threads, count);
+
+	/* The reorder_interval, grid_cell_scale and verlet_skin all change
+	 * the order that neighbours are summed in, so they are left alone for
+	 * reproducible swarms. Divided swarms are sorted into slabs instead
+	 * of being reordered. */
+	if (swarm->process_count <= 1 && !swarm->reproducible) {
+		float intervals[] = { 0, 10, 50 };
+
+		add_tuned_parameter(swarm, TUNE_REORDER_INTERVAL,
+				    "reorder_interval",
+				    MAX(swarm->reorder_interval, 0),
+				    intervals, G_N_ELEMENTS(intervals));
+
+		/* Time each candidate over at least one reorder. */
+		swarm_tuner_set_period(priv->tuner,
+				       MAX(swarm->reorder_interval, 50));
 	}
 
-	/* Limit the rate of particle movement */
-	particle->speed = particle_enforce_speed_limit(priv, particle);
+	uses_grid = swarm->type != SWARM_TYPE_TOPOLOGICAL &&
+		(swarm->neighbour_search == SWARM_SEARCH_GRID ||
+		 swarm->neighbour_search == SWARM_SEARCH_VERLET);
 
-	/* Update position */
-	for (i = 0; i < 3; i++) {
-		position[i] += particle->velocity[i];
+	if (uses_grid && !swarm->reproducible) {
+		float scales[] = { 1, 1.5, 2 };
+
+		add_tuned_parameter(swarm, TUNE_GRID_CELL_SCALE,
+				    "grid_cell_scale",
+				    MAX(swarm->grid_cell_scale, 1),
+				    scales, G_N_ELEMENTS(scales));
+	}
+
+	/* Skins in proportion to the search radius. */
+	if (swarm->type != SWARM_TYPE_TOPOLOGICAL &&
+	    swarm->neighbour_search == SWARM_SEARCH_VERLET &&
+	    !swarm->reproducible) {
+		float skins[] = { 0.1, 0.25, 0.5 };
+
+		for (i = 0; i < G_N_ELEMENTS(skins); i++)
+			skins[i] *= MAX(swarm->particle_distance,
+					swarm->type == SWARM_TYPE_FLOCK ?
+					swarm->particle_sight : 0);
+
+		add_tuned_parameter(swarm, TUNE_VERLET_SKIN, "verlet_skin",
+				    MAX(swarm->verlet_skin, 0),
+				    skins, G_N_ELEMENTS(skins));
+
+		/* Time each candidate over at least one rebuild of the
+		 * neighbour lists, which happens once the fastest particles
+		 * have moved half of the skin. */
+		swarm_tuner_set_period(priv->tuner,
+				       get_rebuild_period(swarm,
+							  MAX(swarm->verlet_skin,
+							      skins[2])));
 	}
 }
 
+/*
+ * Set the parameters chosen by the tuner, which take effect from the next
+ * tick.
+ */
+static void apply_tuning(struct particle_swarm *swarm)
+{
+	struct particle_swarm_priv *priv = swarm->priv;
+	const int *parameters = priv->tune_parameters;
+
+	if (parameters[TUNE_THREAD_COUNT] >= 0)
+		swarm->thread_count = swarm_tuner_get_value(priv->tuner,
+							    parameters[TUNE_THREAD_COUNT]);
+
+	if (parameters[TUNE_REORDER_INTERVAL] >= 0)
+		swarm->reorder_interval = swarm_tuner_get_value(priv->tuner,
+								parameters[TUNE_REORDER_INTERVAL]);
+
+	if (parameters[TUNE_GRID_CELL_SCALE] >= 0)
+		swarm->grid_cell_scale = swarm_tuner_get_value(priv->tuner,
+							       parameters[TUNE_GRID_CELL_SCALE]);
+
+	if (parameters[TUNE_VERLET_SKIN] >= 0)
+		swarm->verlet_skin = swarm_tuner_get_value(priv->tuner,
+							   parameters[TUNE_VERLET_SKIN]);
+}
+
 static void tick(struct particle_swarm *swarm)
 {
 	struct particle_swarm_priv *priv = swarm->priv;
-	struct particle_engine *engine = priv->engine;
-	int i, j;
+	struct swarm_arrays *particles;
+	double start = g_timer_elapsed(priv->timer, NULL);
+	float step;
+	int i, j, thread_count;
+
+	/* The swarms of a group share the group's workers. */
+	if (swarm->autotune && !priv->group && !priv->tuner)
+		create_tuner(swarm);
+
+	priv->dt = get_time_step(priv->group ? priv->group->time_step :
+				 swarm->time_step);
+
+	/* Velocities are the distance moved in one tick, and each particle's
+	 * change in velocity is scaled by it's speed, which is too, so the
+	 * forces which are scaled by dt change velocities by dt squared, as
+	 * they should. The rates are tuned for the default time step, so the
+	 * forces which are not scaled by dt are scaled against it instead,
+	 * and the swarm follows the same dynamics whatever it's time_step. */
+	step = priv->dt / DT;
 
 	for (i = 0; i < 3; i++) {
-		priv->global_accel[i] = swarm->acceleration[i] * DT;
+		priv->global_accel[i] = swarm->acceleration[i] * priv->dt / step;
 	}
 
-	/* Map the particle engine's buffer before reading or writing particle
-	 * data.
-	 */
-	particle_engine_push_buffer(engine,
-				    COGL_BUFFER_ACCESS_READ_WRITE, 0);
-
-	/* Update the cohesion and boundary forces */
-	priv->cohesion_accel = swarm->particle_cohesion_rate * DT;
-	priv->boundary_accel = swarm->boundary_repulsion_rate * DT;
+	/* Update the steering forces */
+	priv->separation_accel = swarm->particle_repulsion_rate * step;
+	priv->cohesion_accel = swarm->particle_cohesion_rate * priv->dt;
+	priv->boundary_accel = swarm->boundary_repulsion_rate * priv->dt;
+	priv->obstacle_accel = swarm->obstacle_repulsion_rate * priv->dt;
 
 	/* Update the speed limits */
-	priv->speed_limits.min = swarm->speed_limits.min * DT;
-	priv->speed_limits.max = swarm->speed_limits.max * DT;
+	priv->speed_limits.min = swarm->speed_limits.min * priv->dt;
+	priv->speed_limits.max = swarm->speed_limits.max * priv->dt;
+
+	/* Create new workers if the thread count has changed. The swarms of a
+	 * group are updated concurrently by the group's workers, so each one
+	 * is updated serially. */
+	thread_count = priv->group ? 1 : MAX(swarm->thread_count, 1);
 
-	if (swarm->type == SWARM_TYPE_HIVE) {
+	if (!priv->pool || priv->thread_count != thread_count) {
+		if (priv->pool)
+			worker_pool_free(priv->pool);
+
+		priv->pool = worker_pool_new(thread_count);
+		priv->thread_count = thread_count;
+	}
+
+	/* The hive sums of a slab are those of the whole swarm, which are
+	 * computed by it's coordinator. */
+	if (swarm->type == SWARM_TYPE_HIVE && !priv->is_slab) {
 		/* Sum the total velocity and position of all the particles: */
-		priv->velocity_sum[0] =
-			priv->velocity_sum[1] =
-			priv->velocity_sum[2] =
-			priv->position_sum[0] =
-			priv->position_sum[1] =
-			priv->position_sum[2] = 0;
+		int block_count = (swarm->particle_count + HIVE_BLOCK_SIZE - 1) /
+			HIVE_BLOCK_SIZE;
 
-		for (i = 0; i < swarm->particle_count; i++) {
-			float *position = particle_engine_get_particle_position(engine, i);
+		if (!priv->hive_block_sums)
+			priv->hive_block_sums = g_new(float, MAX(block_count, 1) * 6);
 
+		worker_pool_run_chunks(priv->pool, block_count, 1,
+				       sum_hive_blocks, swarm);
+
+		for (j = 0; j < 3; j++) {
+			priv->velocity_sum[j] = 0;
+			priv->position_sum[j] = 0;
+		}
+
+		for (i = 0; i < block_count; i++) {
 			for (j = 0; j < 3; j++) {
-				priv->velocity_sum[j] += priv->particles[i].velocity[j];
-				priv->position_sum[j] += position[j];
+				priv->velocity_sum[j] += priv->hive_block_sums[i * 6 + j];
+				priv->position_sum[j] += priv->hive_block_sums[i * 6 + 3 + j];
 			}
 		}
 	}
 
-	/* Iterate over every particle and update them. */
-	for (i = 0; i < swarm->particle_count; i++)
-		update_particle(swarm, i, DT);
+	priv->search_radius = swarm->particle_distance;
+	if (swarm->type == SWARM_TYPE_FLOCK)
+		priv->search_radius = MAX(priv->search_radius,
+					  swarm->particle_sight);
 
-	/* Unmap the modified particle buffer. */
-	particle_engine_pop_buffer(engine);
+	if (priv->processes)
+		tick_slabs(swarm);
+	else
+		tick_particles(swarm);
+
+	/* Swap the particle buffers */
+	particles = priv->particles;
+	priv->particles = priv->next_particles;
+	priv->next_particles = particles;
+
+	if (is_staggered(swarm) && !priv->processes)
+		update_aggregate_stats(swarm);
+
+	if (priv->index)
+		update_index(swarm);
+
+	priv->tick_count++;
+
+	if (priv->tuner && swarm->autotune &&
+	    swarm_tuner_report(priv->tuner,
+			       g_timer_elapsed(priv->timer, NULL) - start))
+		apply_tuning(swarm);
+}
+
+/*
+ * Copy the particle positions into the engine's buffer, which must be mapped,
+ * interpolated between the previous tick (alpha = 0) and the current tick
+ * (alpha = 1).
+ */
+static void update_vertices(struct particle_swarm *swarm, float alpha)
+{
+	struct particle_swarm_priv *priv = swarm->priv;
+	const struct swarm_arrays *particles = priv->particles;
+	const struct swarm_arrays *previous = priv->next_particles;
+	int i, j;
+
+	for (i = 0; i < swarm->particle_count; i++) {
+		float *position = particle_engine_get_particle_position(priv->engine,
+									priv->particle_offset + i);
+
+		for (j = 0; j < 3; j++) {
+			position[j] = previous->position[j][i] + alpha *
+				(particles->position[j][i] - previous->position[j][i]);
+		}
+	}
 }
 
 void particle_swarm_paint(struct particle_swarm *swarm)
 {
 	struct particle_swarm_priv *priv = swarm->priv;
 	struct particle_engine *engine;
-	float frame_time, time;
+	float frame_time, time, dt = get_time_step(swarm->time_step);
+
+	/* Grouped swarms are painted by their group */
+	g_return_if_fail(priv->group == NULL);
 
 	/* Create resources as necessary */
-	if (priv->engine == NULL) {
+	if (priv->prepare_thread || priv->engine == NULL) {
 		create_resources(swarm);
 		tick(swarm);
 	}
@@ -417,14 +2473,376 @@ void particle_swarm_paint(struct particle_swarm *swarm)
 
 	/* Enforce a maximum frame time to prevent the "spiral of death" when
 	 * operating under heavy load */
-	if (frame_time > MAX_FRAME_TIME)
-		frame_time = MAX_FRAME_TIME;
+	if (frame_time > MAX(MAX_FRAME_TIME, dt))
+		frame_time = MAX(MAX_FRAME_TIME, dt);
 
 	priv->accumulator += frame_time;
 
 	/* Update the simulation state as required */
-	for ( ; priv->accumulator >= DT; priv->accumulator -= DT)
+	for ( ; priv->accumulator >= dt; priv->accumulator -= dt)
 		tick(swarm);
 
+	/* Draw the particles part of the way to their next positions, by the
+	 * time left over. */
+	particle_engine_push_buffer(engine, COGL_BUFFER_ACCESS_READ_WRITE, 0);
+	update_vertices(swarm, priv->accumulator / dt);
+	particle_engine_pop_buffer(engine);
+
 	particle_engine_paint(engine);
 }
+
+gboolean particle_swarm_save(struct particle_swarm *swarm,
+			     const char *filename)
+{
+	struct particle_swarm_priv *priv = swarm->priv;
+	struct swarm_snapshot snapshot = { 0 };
+	CoglColor *color;
+	gboolean saved;
+	int i;
+
+	/* The particles of grouped swarms are saved by their group */
+	g_return_val_if_fail(priv->group == NULL, FALSE);
+
+	if (priv->prepare_thread || priv->engine == NULL) {
+		create_resources(swarm);
+		tick(swarm);
+	}
+
+	snapshot.particle_count = swarm->particle_count;
+	snapshot.create_seed = priv->create_seed;
+	snapshot.tick_count = priv->tick_count;
+	snapshot.ticks_since_reorder = priv->ticks_since_reorder;
+	snapshot.buffers[0] = *priv->particles;
+	snapshot.buffers[1] = *priv->next_particles;
+	snapshot.colors = g_new(float, swarm->particle_count * 4);
+
+	particle_engine_push_buffer(priv->engine, COGL_BUFFER_ACCESS_READ, 0);
+
+	for (i = 0; i < swarm->particle_count; i++) {
+		color = particle_engine_get_particle_color(priv->engine, i);
+
+		snapshot.colors[i * 4 + 0] = cogl_color_get_red(color);
+		snapshot.colors[i * 4 + 1] = cogl_color_get_green(color);
+		snapshot.colors[i * 4 + 2] = cogl_color_get_blue(color);
+		snapshot.colors[i * 4 + 3] = cogl_color_get_alpha(color);
+	}
+
+	particle_engine_pop_buffer(priv->engine);
+
+	saved = swarm_snapshot_save(&snapshot, filename);
+	g_free(snapshot.colors);
+
+	return saved;
+}
+
+gboolean particle_swarm_load(struct particle_swarm *swarm,
+			     const char *filename)
+{
+	struct particle_swarm_priv *priv = swarm->priv;
+	struct swarm_snapshot *snapshot;
+
+	/* Only swarms whose particles haven't been created can be loaded */
+	g_return_val_if_fail(priv->group == NULL, FALSE);
+	g_return_val_if_fail(priv->engine == NULL, FALSE);
+	g_return_val_if_fail(priv->prepare_thread == NULL, FALSE);
+
+	snapshot = swarm_snapshot_load(filename);
+	if (!snapshot)
+		return FALSE;
+
+	if (priv->snapshot)
+		swarm_snapshot_free(priv->snapshot);
+
+	priv->snapshot = snapshot;
+	swarm->particle_count = snapshot->particle_count;
+
+	return TRUE;
+}
+
+void particle_swarm_get_stats(struct particle_swarm *swarm,
+			      struct particle_swarm_stats *stats)
+{
+	*stats = swarm->priv->stats;
+}
+
+/*
+ * Return the swarm's query index, creating it if necessary, or NULL if the
+ * swarm has no particles yet.
+ */
+static struct particle_index *get_index(struct particle_swarm *swarm)
+{
+	struct particle_swarm_priv *priv = swarm->priv;
+
+	/* The particles of a swarm which is being prepared are not ready
+	 * until it's first paint. */
+	if (priv->prepare_thread || !priv->particles)
+		return NULL;
+
+	/* Queries are usually on the scale of the particles' own
+	 * neighbourhoods. */
+	if (!priv->index) {
+		priv->index = particle_index_new(swarm->particle_count,
+						 MAX(MAX(swarm->particle_distance,
+							 swarm->particle_sight),
+						     swarm->particle_size));
+		update_index(swarm);
+	}
+
+	return priv->index;
+}
+
+int particle_swarm_query_radius(struct particle_swarm *swarm,
+				const float *position, float radius,
+				int *results, int max_results)
+{
+	struct particle_index *index = get_index(swarm);
+
+	return index ? particle_index_find_radius(index, position, radius,
+						  results, max_results) : 0;
+}
+
+int particle_swarm_query_nearest(struct particle_swarm *swarm,
+				 const float *position, int k, int *results)
+{
+	struct particle_index *index = get_index(swarm);
+
+	return index ? particle_index_find_nearest(index, position, k,
+						   results) : 0;
+}
+
+int particle_swarm_query_ray(struct particle_swarm *swarm,
+			     const float *origin, const float *direction,
+			     float radius, float max_distance,
+			     float *distance)
+{
+	struct particle_index *index = get_index(swarm);
+
+	return index ? particle_index_find_ray(index, origin, direction,
+					       radius, max_distance,
+					       distance) : -1;
+}
+
+void particle_swarm_query_batch(struct particle_swarm *swarm,
+				struct particle_query *queries, int count)
+{
+	struct particle_index *index = get_index(swarm);
+	int i;
+
+	if (!index) {
+		for (i = 0; i < count; i++)
+			queries[i].result_count = 0;
+		return;
+	}
+
+	particle_index_query_batch(index, queries, count, swarm->priv->pool);
+}
+
+struct particle_swarm_group_priv {
+	GTimer *timer;
+	gdouble current_time;
+	gdouble accumulator;
+
+	/* The swarms in the group. */
+	struct particle_swarm **swarms;
+	int swarm_count;
+
+	/* The particle state of every swarm. Each swarm's own buffers point
+	 * into these. */
+	struct swarm_arrays buffers[2];
+
+	/* The workers used to update swarms, and the thread count that they
+	 * were created with. */
+	struct worker_pool *pool;
+	int thread_count;
+
+	CoglContext *ctx;
+	CoglFramebuffer *fb;
+	struct particle_engine *engine;
+};
+
+struct particle_swarm_group *particle_swarm_group_new(CoglContext *ctx,
+						      CoglFramebuffer *fb)
+{
+	struct particle_swarm_group *group = g_slice_new0(struct particle_swarm_group);
+	struct particle_swarm_group_priv *priv =
+		g_slice_new0(struct particle_swarm_group_priv);
+
+	priv->ctx = cogl_object_ref(ctx);
+	priv->fb = cogl_object_ref(fb);
+
+	priv->timer = g_timer_new();
+
+	group->priv = priv;
+
+	return group;
+}
+
+void particle_swarm_group_free(struct particle_swarm_group *group)
+{
+	struct particle_swarm_group_priv *priv = group->priv;
+	int i;
+
+	for (i = 0; i < priv->swarm_count; i++)
+		particle_swarm_free(priv->swarms[i]);
+	g_free(priv->swarms);
+
+	cogl_object_unref(priv->ctx);
+	cogl_object_unref(priv->fb);
+
+	g_timer_destroy(priv->timer);
+
+	if (priv->engine)
+		particle_engine_free(priv->engine);
+
+	if (priv->pool)
+		worker_pool_free(priv->pool);
+
+	swarm_arrays_clear(&priv->buffers[0]);
+	swarm_arrays_clear(&priv->buffers[1]);
+
+	g_slice_free(struct particle_swarm_group_priv, priv);
+	g_slice_free(struct particle_swarm_group, group);
+}
+
+void particle_swarm_group_add(struct particle_swarm_group *group,
+			      struct particle_swarm *swarm)
+{
+	struct particle_swarm_group_priv *priv = group->priv;
+
+	g_return_if_fail(priv->engine == NULL);
+	g_return_if_fail(swarm->priv->engine == NULL);
+	g_return_if_fail(swarm->priv->prepare_thread == NULL);
+
+	priv->swarms = g_renew(struct particle_swarm *, priv->swarms,
+			       priv->swarm_count + 1);
+	priv->swarms[priv->swarm_count++] = swarm;
+
+	swarm->priv->group = group;
+}
+
+static void tick_swarms(gpointer data, int start, int end, int worker)
+{
+	struct particle_swarm_group *group = data;
+	int i;
+
+	(void)worker;
+
+	for (i = start; i < end; i++)
+		tick(group->priv->swarms[i]);
+}
+
+/*
+ * Tick every swarm in the group. The engine's buffer must be mapped.
+ */
+static void group_tick(struct particle_swarm_group *group)
+{
+	struct particle_swarm_group_priv *priv = group->priv;
+
+	/* Create new workers if the thread count has changed. */
+	if (!priv->pool || priv->thread_count != group->thread_count) {
+		if (priv->pool)
+			worker_pool_free(priv->pool);
+
+		priv->pool = worker_pool_new(MAX(group->thread_count, 1));
+		priv->thread_count = group->thread_count;
+	}
+
+	/* Swarms vary in cost, so they are handed out one at a time. */
+	worker_pool_run_chunks(priv->pool, priv->swarm_count, 1,
+			       tick_swarms, group);
+}
+
+static void create_group_resources(struct particle_swarm_group *group)
+{
+	struct particle_swarm_group_priv *priv = group->priv;
+	int i, particle_count = 0;
+
+	for (i = 0; i < priv->swarm_count; i++)
+		particle_count += priv->swarms[i]->particle_count;
+
+	priv->engine = particle_engine_new(priv->ctx, priv->fb,
+					   particle_count,
+					   group->particle_size);
+
+	swarm_arrays_init(&priv->buffers[0], particle_count);
+	swarm_arrays_init(&priv->buffers[1], particle_count);
+
+	particle_engine_push_buffer(priv->engine,
+				    COGL_BUFFER_ACCESS_READ_WRITE, 0);
+
+	for (i = 0, particle_count = 0; i < priv->swarm_count; i++) {
+		struct particle_swarm *swarm = priv->swarms[i];
+		struct particle_swarm_priv *swarm_priv = swarm->priv;
+
+		swarm_priv->engine = priv->engine;
+		swarm_priv->particle_offset = particle_count;
+
+		get_arrays_range(&swarm_priv->buffers[0], &priv->buffers[0],
+				 particle_count, swarm->particle_count);
+		get_arrays_range(&swarm_priv->buffers[1], &priv->buffers[1],
+				 particle_count, swarm->particle_count);
+
+		create_particles(swarm);
+
+		particle_count += swarm->particle_count;
+	}
+
+	/* Tick once, so that there is a previous state to interpolate from. */
+	group_tick(group);
+
+	particle_engine_pop_buffer(priv->engine);
+}
+
+static void update_group_vertices(gpointer data, int start, int end,
+				  int worker)
+{
+	struct particle_swarm_group *group = data;
+	struct particle_swarm_group_priv *priv = group->priv;
+	int i;
+
+	(void)worker;
+
+	for (i = start; i < end; i++)
+		update_vertices(priv->swarms[i], priv->accumulator /
+				get_time_step(group->time_step));
+}
+
+void particle_swarm_group_paint(struct particle_swarm_group *group)
+{
+	struct particle_swarm_group_priv *priv = group->priv;
+	float frame_time, time, dt = get_time_step(group->time_step);
+
+	/* Create resources as necessary */
+	if (priv->engine == NULL)
+		create_group_resources(group);
+
+	/* Every swarm writes to it's own range of the engine's buffer, so the
+	 * buffer is mapped once for them all. */
+	particle_engine_push_buffer(priv->engine,
+				    COGL_BUFFER_ACCESS_READ_WRITE, 0);
+
+	/* Update the clocks */
+	time = g_timer_elapsed(priv->timer, NULL);
+	frame_time = time - priv->current_time;
+	priv->current_time = time;
+
+	/* Enforce a maximum frame time to prevent the "spiral of death" when
+	 * operating under heavy load */
+	if (frame_time > MAX(MAX_FRAME_TIME, dt))
+		frame_time = MAX(MAX_FRAME_TIME, dt);
+
+	priv->accumulator += frame_time;
+
+	/* Update the simulation state as required */
+	for ( ; priv->accumulator >= dt; priv->accumulator -= dt)
+		group_tick(group);
+
+	/* Draw the particles part of the way to their next positions, by the
+	 * time left over. */
+	worker_pool_run_chunks(priv->pool, priv->swarm_count, 1,
+			       update_group_vertices, group);
+
+	particle_engine_pop_buffer(priv->engine);
+
+	particle_engine_paint(priv->engine);
+}
@@ -1,11 +1,54 @@
 #ifndef _PARTICLE_SWARM_H_
 #define _PARTICLE_SWARM_H_
 
+#include "distance-field.h"
 #include "fuzzy.h"
+#include "particle-index.h"
 
 /* <priv> */
 struct particle_swarm_priv;
 
+struct particle_swarm;
+
+/*
+ * Log a message about a swarm, such as a decision made by it's tuner.
+ */
+typedef void (*particle_swarm_log_func)(struct particle_swarm *swarm,
+					const char *message, gpointer data);
+
+/* The maximum number of neighbours of SWARM_TYPE_TOPOLOGICAL particles. */
+#define SWARM_MAX_TOPOLOGICAL_NEIGHBOURS 32
+
+/* The maximum number of level of detail bands. */
+#define SWARM_MAX_LOD_BANDS 8
+
+/*
+ * Statistics gathered while a swarm runs, which can be used to tune it.
+ */
+struct particle_swarm_stats {
+	/* The number of times that the neighbour lists of a SWARM_SEARCH_VERLET
+	 * swarm have been rebuilt. */
+	int neighbour_list_rebuilds;
+
+	/* The average number of particles in each neighbour list, as of the
+	 * last rebuild. */
+	float neighbour_list_length;
+
+	/* The number of times that the particles have been reordered, and the
+	 * total time (in seconds) spent doing so. */
+	int reorders;
+	double reorder_time;
+
+	/* When aggregate_interval is greater than one or there are level of
+	 * detail bands, the average number of
+	 * ticks since each particle's neighbour sums were computed, and the
+	 * average and greatest distance (in pixels) that particles have moved
+	 * since, as of the last tick. */
+	float aggregate_age;
+	float aggregate_drift;
+	float aggregate_max_drift;
+};
+
 /*
  * A particle swarm
  */
@@ -26,6 +69,15 @@ struct particle_swarm {
 	/* The rate at which particles are repelled from the boundaries */
 	float boundary_repulsion_rate;
 
+	/* Static obstacles which particles avoid, as a signed distance field,
+	 * or NULL for none. The field is not owned by the swarm, and must
+	 * outlive it. */
+	const struct distance_field *obstacles;
+	/* The distance from an obstacle at which particles are repelled */
+	float obstacle_threshold;
+	/* The rate at which particles are repelled from obstacles */
+	float obstacle_repulsion_rate;
+
 	/* The minimum and maximum speeds at which particles may move */
 	struct {
 		float min;
@@ -44,15 +96,200 @@ struct particle_swarm {
 	 *  only a limited range of the surrounding particles, meaning that they
 	 *  can flock together into small groups which behave independently and
 	 *  interact with one another.
+	 *
+	 * TOPOLOGICAL
+	 *  This swarm exhibits flocking patterns like FLOCK, but particles
+	 *  only interact with a fixed number of their nearest neighbours
+	 *  (topological_neighbours), however near or far they are. Flocks
+	 *  stay cohesive as they spread out. The neighbours are found with
+	 *  an octree whose leaves hold a few particles each, so the cost of a
+	 *  tick does not grow as particles bunch together. The
+	 *  neighbour_search method is not used.
 	 */
 	enum {
 		SWARM_TYPE_HIVE,
-		SWARM_TYPE_FLOCK
+		SWARM_TYPE_FLOCK,
+		SWARM_TYPE_TOPOLOGICAL
 	} type;
 
+	/* The number of nearest neighbours that each particle interacts with
+	 * in SWARM_TYPE_TOPOLOGICAL swarms, up to
+	 * SWARM_MAX_TOPOLOGICAL_NEIGHBOURS. Studies of starlings suggest 6 or
+	 * 7. */
+	int topological_neighbours;
+
+	/* The method used to find the neighbours of each particle.
+	 *
+	 * GRID
+	 *  Particles are binned into a uniform grid once per tick, and each
+	 *  particle only visits the particles in the cells surrounding it. The
+	 *  cost of a tick grows with the density of the swarm rather than
+	 *  it's size.
+	 *
+	 * BRUTE_FORCE
+	 *  Each particle visits every other particle, so the cost of a tick
+	 *  grows with the square of the number of particles. This gives the
+	 *  same results as GRID, and is kept as a reference.
+	 *
+	 * OCTREE
+	 *  Particles are sorted into an octree once per tick, and distant
+	 *  groups of particles are treated as a single particle at their
+	 *  center of mass when computing cohesion and alignment. Separation
+	 *  is always exact. This suits swarms with a long range of sight,
+	 *  where each particle can see a large part of the swarm.
+	 *
+	 * VERLET
+	 *  Each particle keeps a list of the particles within a slightly
+	 *  larger radius than it needs (by verlet_skin), and only visits
+	 *  those. The lists are only rebuilt once a particle has moved
+	 *  further than half of the skin, which particles take many ticks to
+	 *  do. This gives the same results as GRID.
+	 */
+	enum {
+		SWARM_SEARCH_GRID,
+		SWARM_SEARCH_BRUTE_FORCE,
+		SWARM_SEARCH_OCTREE,
+		SWARM_SEARCH_VERLET
+	} neighbour_search;
+
+	/* The opening angle of SWARM_SEARCH_OCTREE swarms. A group of
+	 * particles with extent l at distance d from a particle is treated as
+	 * a single particle if l / d < octree_theta. Larger values are faster
+	 * but less accurate, and zero is exact. Around 0.5 is a reasonable
+	 * compromise. */
+	float octree_theta;
+
+	/* The distance (in pixels) added to the search radius of
+	 * SWARM_SEARCH_VERLET neighbour lists. A larger skin means longer lists
+	 * which need rebuilding less often. */
+	float verlet_skin;
+
+	/* The size of the cells of the grid used to find neighbours, as a
+	 * multiple of the search radius. Larger cells mean fewer cells to
+	 * visit, but more particles in each. If less than one, then the cells
+	 * are the size of the search radius. */
+	float grid_cell_scale;
+
+	/* If TRUE, then SWARM_SEARCH_GRID swarms store the copy of the
+	 * particles that neighbour searches read in a quantized form, using
+	 * 13 bytes per particle rather than 28 (see swarm-compact.h). Large
+	 * swarms are limited by the speed of memory rather than arithmetic,
+	 * and on a single core this halved the tick time of a 200,000
+	 * particle flock, at the cost of a small error in the positions,
+	 * velocities and sizes that particles see of their neighbours: at
+	 * most 0.012 pixels for a 1024 pixel swarm. Each
+	 * particle's own state is kept at full precision, so the quantized
+	 * copy adds 13 bytes per particle to the memory that the swarm uses,
+	 * rather than saving any. Ignored by other neighbour searches and by
+	 * SWARM_TYPE_TOPOLOGICAL swarms. */
+	gboolean compact_storage;
+
+	/* The number of ticks between recomputing the neighbour sums of each
+	 * particle. Each tick, 1 in aggregate_interval particles recompute
+	 * their sums in turn, and the rest reuse the sums they last computed,
+	 * which divides the cost of finding neighbours by the interval. Every
+	 * particle still moves every tick. This suits large swarms whose
+	 * steering changes slowly. If zero or one, then every particle
+	 * recomputes it's sums every tick. */
+	int aggregate_interval;
+
+	/* Level of detail. Particles which are far from the viewpoint are
+	 * small on screen, so they can recompute their neighbour sums less
+	 * often, in the same way as aggregate_interval. Particles which are at
+	 * least lod_bands[i].distance from lod_viewpoint recompute their sums
+	 * every lod_bands[i].interval ticks, or every aggregate_interval ticks
+	 * if that is larger. Every particle still moves every tick. Only the
+	 * first lod_band_count bands are used, so if zero then every particle
+	 * is treated the same. */
+	float lod_viewpoint[3];
+	struct {
+		float distance;
+		int interval;
+	} lod_bands[SWARM_MAX_LOD_BANDS];
+	int lod_band_count;
+
+	/* The interval (in seconds) between ticks of the simulation. Particle
+	 * positions are interpolated between ticks when drawn, so the swarm
+	 * still moves smoothly when simulated at a lower rate than it is
+	 * drawn. The steering rates below are per tick at 200 Hz, and are
+	 * scaled to the time step, so the swarm follows the same dynamics at
+	 * any rate, although the longer the step, the coarser the simulation.
+	 * If zero, then the swarm is ticked at 200 Hz. */
+	float time_step;
+
+	/* The number of threads used to update particles. Particles are split
+	 * into chunks which are shared between the threads, and the calling
+	 * thread always takes part. If zero or one, then the particles are
+	 * updated serially on the calling thread. */
+	int thread_count;
+
+	/* If TRUE, then the swarm gives bit-identical results for the same
+	 * seed, whatever it's thread_count. Each particle accumulates the
+	 * influence of it's own neighbours in a fixed order, rather than
+	 * each pair of neighbours being visited once by whichever thread
+	 * reaches it first. This makes SWARM_SEARCH_GRID ticks 10-20% slower,
+	 * and SWARM_SEARCH_BRUTE_FORCE ticks up to twice as slow. Other
+	 * searches are always reproducible. The particles are created in
+	 * fixed chunks, each from a random stream seeded by seed and the
+	 * chunk's index. */
+	gboolean reproducible;
+	guint32 seed;
+
+	/* The number of processes that the swarm is divided between. If
+	 * greater than one, then the swarm is split along the x axis into
+	 * slabs, and each process (including the calling one) updates the
+	 * particles of one slab, seeing the particles within range of it's
+	 * edges as ghosts. Each slab keeps it's particles until one has moved
+	 * a search radius from where it started, and then the particles are
+	 * shared out again and the slabs rebalanced. The particles are
+	 * kept in POSIX shared memory, so the vertices are written by the
+	 * calling process as usual. The worker processes are forked on the
+	 * first paint, so any obstacles must be set before then, and only
+	 * the calling process may use Cogl. If a worker process dies, then
+	 * the calling process aborts. Neighbour searches are limited to
+	 * the ghosts, so SWARM_TYPE_TOPOLOGICAL particles only find
+	 * neighbours within their search radius, and reproducible swarms are
+	 * only reproducible for the same process_count. Particles are never
+	 * reordered or aggregated in a divided swarm. This is ignored by
+	 * grouped swarms. */
+	int process_count;
+
+	/* If TRUE, then the swarm tunes it's thread_count, reorder_interval,
+	 * grid_cell_scale and verlet_skin (whichever of them affect it's
+	 * neighbour search) for speed as it runs, and overwrites them with the
+	 * fastest values found (see swarm-tuner.h). Candidate values are
+	 * timed one parameter at a time over the first few hundred ticks,
+	 * starting from the values that the swarm was configured with. The
+	 * swarm is tuned again whenever the tick time drifts from the tuned
+	 * time by more than autotune_threshold (25% if zero) for a while.
+	 * The reorder_interval, grid_cell_scale and verlet_skin of
+	 * reproducible swarms are left alone, as they change the order that
+	 * neighbours are summed in. Ignored by grouped swarms. */
+	gboolean autotune;
+	float autotune_threshold;
+
+	/* If not NULL, then this is called with each decision made by the
+	 * tuner. */
+	particle_swarm_log_func autotune_log;
+	gpointer autotune_log_data;
+
+	/* The number of ticks between reordering the particles in memory. As
+	 * particles move, the particles that are close together in space end
+	 * up far apart in memory, which makes visiting neighbours slow. Every
+	 * reorder_interval ticks, the particles are sorted along a space
+	 * filling curve so that neighbours are close together in memory
+	 * again. If zero, then particles are never reordered. */
+	int reorder_interval;
+
 	/* The distance (in pixels) that particles can detect other particles in
-	 * the surrounding area. Only used for swarms with SWARM_TYPE_FLOCK
-	 * behaviour. */
+	 * the surrounding area. SWARM_TYPE_FLOCK particles steer towards the
+	 * particles in sight with every neighbour search, so these swarms search
+	 * as far as MAX(particle_distance, particle_sight): this sizes the
+	 * cells of SWARM_SEARCH_GRID swarms, the reach of SWARM_SEARCH_OCTREE
+	 * and SWARM_SEARCH_VERLET searches and the tuner's verlet_skin
+	 * candidates, and the slabs of divided swarms. SWARM_TYPE_HIVE and
+	 * SWARM_TYPE_TOPOLOGICAL swarms only use it to size the cells of the
+	 * index for spatial queries. */
 	float particle_sight;
 
 	/* The rate at which particles are attracted to each-other */
@@ -83,6 +320,123 @@ struct particle_swarm *particle_swarm_new(CoglContext *ctx, CoglFramebuffer *fb)
 
 void particle_swarm_free(struct particle_swarm *swarm);
 
+/*
+ * Start creating the swarm's particles on a background thread, so that the
+ * first paint only has to upload their vertices rather than create them.
+ * Large swarms are created in parallel, by thread_count threads. The swarm
+ * must be fully configured first, and must not be changed until it has been
+ * painted. Swarms which are not prepared are created by their first paint, as
+ * before. Divided swarms fork their processes here. Grouped swarms cannot be
+ * prepared.
+ */
+void particle_swarm_prepare(struct particle_swarm *swarm);
+
 void particle_swarm_paint(struct particle_swarm *swarm);
 
+/*
+ * Save the state of every particle to a snapshot file (see swarm-snapshot.h),
+ * between paints. A swarm which hasn't been painted yet is created first.
+ * Returns FALSE if the file couldn't be written. Grouped swarms cannot be
+ * saved.
+ */
+gboolean particle_swarm_save(struct particle_swarm *swarm,
+			     const char *filename);
+
+/*
+ * Start the swarm from a snapshot saved by particle_swarm_save(), rather than
+ * from random particles. This must be called before the swarm is prepared or
+ * painted, and sets particle_count to the number of particles saved. The rest
+ * of the swarm's configuration is left alone. The file is mapped, and the
+ * particle arrays are read from the mapping rather than copied, but the color
+ * of every particle is still converted into it's vertex, and a divided swarm
+ * (see process_count) copies both of it's buffers into shared memory, so this
+ * takes time in proportion to the size of the swarm. Returns FALSE if the
+ * file isn't a snapshot of the current version, in which case the swarm is
+ * created as usual.
+ */
+gboolean particle_swarm_load(struct particle_swarm *swarm,
+			     const char *filename);
+
+/*
+ * Get the statistics which have been gathered since the swarm was created.
+ */
+void particle_swarm_get_stats(struct particle_swarm *swarm,
+			      struct particle_swarm_stats *stats);
+
+/*
+ * Spatial queries over the particles of the swarm, which return particle
+ * indices (see particle-index.h). Queries see the particles as of the last
+ * tick, and the indices are only valid until the next tick, as particles may
+ * be reordered. The swarm's index is created by the first query, and then kept
+ * up to date as the swarm ticks. Before the swarm's first paint, queries find
+ * no particles.
+ */
+int particle_swarm_query_radius(struct particle_swarm *swarm,
+				const float *position, float radius,
+				int *results, int max_results);
+
+int particle_swarm_query_nearest(struct particle_swarm *swarm,
+				 const float *position, int k, int *results);
+
+int particle_swarm_query_ray(struct particle_swarm *swarm,
+			     const float *origin, const float *direction,
+			     float radius, float max_distance,
+			     float *distance);
+
+/*
+ * Run many queries at once, shared between the swarm's threads.
+ */
+void particle_swarm_query_batch(struct particle_swarm *swarm,
+				struct particle_query *queries, int count);
+
+/* <priv> */
+struct particle_swarm_group_priv;
+
+/*
+ * A group of independent particle swarms, which are updated together and drawn
+ * in a single draw call.
+ *
+ * Each swarm in the group is configured through it's own fields, as though it
+ * were on it's own, but the particles of every swarm are stored contiguously
+ * in a single set of buffers and a single vertex buffer. A tick maps the
+ * vertex buffer once, and the swarms are shared between a pool of worker
+ * threads. This makes thousands of small swarms practical, where they would
+ * otherwise cost a draw call and a buffer map each. Small swarms are best
+ * served by SWARM_SEARCH_BRUTE_FORCE neighbour searches.
+ */
+struct particle_swarm_group {
+	/* The size (in pixels) of particles. Every particle in the group is
+	 * drawn at the same size. */
+	float particle_size;
+
+	/* The number of threads used to update the swarms. If zero or one,
+	 * then the swarms are updated serially on the calling thread. */
+	int thread_count;
+
+	/* The interval (in seconds) between ticks of every swarm in the group.
+	 * The time_step of the swarms themselves is not used. If zero, then
+	 * the swarms are ticked at 200 Hz. */
+	float time_step;
+
+	/* <priv> */
+	struct particle_swarm_group_priv *priv;
+};
+
+struct particle_swarm_group *particle_swarm_group_new(CoglContext *ctx,
+						      CoglFramebuffer *fb);
+
+/*
+ * Free the group, along with every swarm in it.
+ */
+void particle_swarm_group_free(struct particle_swarm_group *group);
+
+/*
+ * Add a swarm to the group, which takes ownership of it. Swarms must be added
+ * before the group is first painted, and must not be painted themselves.
+ */
+void particle_swarm_group_add(struct particle_swarm_group *group,
+			      struct particle_swarm *swarm);
+
+void particle_swarm_group_paint(struct particle_swarm_group *group);
+
 #endif /* _PARTICLE_SWARM_H_ */
@@ -1,11 +1,16 @@
 #include "particle-system.h"
 
 #include "particle-engine.h"
+#include "worker-pool.h"
 
 #include <cogl/cogl.h>
 #include <math.h>
 #include <string.h>
 
+/* The number of particles created from each random stream. The streams are
+ * shared out between workers when there is more than one. */
+#define CREATE_CHUNK_SIZE 4096
+
 struct particle {
 	/* The radius of the orbit */
 	float radius;
@@ -34,6 +39,14 @@ struct particle_system_priv {
 
 	struct particle *particles;
 
+	/* The seed of the random streams that the particles are created
+	 * from. */
+	guint32 create_seed;
+
+	/* The thread creating the particles of a prepared system, until it is
+	 * joined by the first paint (see particle_system_prepare()). */
+	GThread *prepare_thread;
+
 	CoglContext *ctx;
 	CoglFramebuffer *fb;
 	struct particle_engine *engine;
@@ -56,23 +69,41 @@ struct particle_system* particle_system_new(CoglContext *ctx,
 	return system;
 }
 
+/*
+ * Wait for the thread preparing the system, if there is one.
+ */
+static void join_prepare_thread(struct particle_system *system)
+{
+	struct particle_system_priv *priv = system->priv;
+
+	if (priv->prepare_thread) {
+		g_thread_join(priv->prepare_thread);
+		priv->prepare_thread = NULL;
+	}
+}
+
 void particle_system_free(struct particle_system *system)
 {
 	struct particle_system_priv *priv = system->priv;
 
+	join_prepare_thread(system);
+
 	cogl_object_unref(priv->ctx);
 	cogl_object_unref(priv->fb);
 
 	g_rand_free(priv->rand);
 	g_timer_destroy(priv->timer);
 
-	particle_engine_free(priv->engine);
+	if (priv->engine)
+		particle_engine_free(priv->engine);
+
+	g_free(priv->particles);
 
 	g_slice_free(struct particle_system_priv, priv);
 	g_slice_free(struct particle_system, system);
 }
 
-static void create_particle(struct particle_system *system,
+static void create_particle(struct particle_system *system, GRand *rand,
 			    int index)
 {
 	struct particle_system_priv *priv = system->priv;
@@ -83,19 +114,19 @@ static void create_particle(struct particle_system *system,
 	color = particle_engine_get_particle_color(priv->engine, index);
 
 	/* Get angle of inclination */
-	particle->inclination = fuzzy_float_get_real_value(&system->inclination, priv->rand);
+	particle->inclination = fuzzy_float_get_real_value(&system->inclination, rand);
 
 	/* Get the ascending node */
-	particle->ascending_node = g_random_double_range(0, M_PI * 2);
+	particle->ascending_node = g_rand_double_range(rand, 0, M_PI * 2);
 
 	/* Particle color. */
-	fuzzy_color_get_cogl_color(&system->particle_color, priv->rand, color);
+	fuzzy_color_get_cogl_color(&system->particle_color, rand, color);
 
 	switch (system->type) {
 	case SYSTEM_TYPE_CIRCULAR_ORBIT:
 		/* Get orbital radius */
 		particle->radius = fuzzy_float_get_real_value(&system->radius,
-							      priv->rand);
+							      rand);
 
 		/* Orbital velocity */
 		particle->speed = system->u / particle->radius;
@@ -110,30 +141,90 @@ static void create_particle(struct particle_system *system,
 		period = 2 * M_PI * sqrt(powf(particle->radius, 3) / system->u);
 
 		/* Start the orbit at a random point around it's circumference. */
-		particle->t_offset = g_rand_double_range(priv->rand, 0, period);
+		particle->t_offset = g_rand_double_range(rand, 0, period);
 
 		break;
 	}
 }
 
-static void create_resources(struct particle_system *system)
+static void create_particle_chunks(gpointer data, int start, int end,
+				   int worker)
+{
+	struct particle_system *system = data;
+	int c, i;
+
+	(void)worker;
+
+	for (c = start; c < end; c++) {
+		guint32 seed[2] = { system->priv->create_seed, c };
+		GRand *rand = g_rand_new_with_seed_array(seed,
+							 G_N_ELEMENTS(seed));
+		int last = MIN((c + 1) * CREATE_CHUNK_SIZE,
+			       system->particle_count);
+
+		for (i = c * CREATE_CHUNK_SIZE; i < last; i++)
+			create_particle(system, rand, i);
+
+		g_rand_free(rand);
+	}
+}
+
+/*
+ * Create the particles, and the engine which holds their vertices until the
+ * render thread realizes it. This can be run on any thread.
+ */
+static void create_state(struct particle_system *system)
 {
 	struct particle_system_priv *priv = system->priv;
-	int i;
+	struct worker_pool *pool;
+	int chunk_count = (system->particle_count + CREATE_CHUNK_SIZE - 1) /
+		CREATE_CHUNK_SIZE;
 
-	priv->engine = particle_engine_new(priv->ctx, priv->fb,
-					   system->particle_count,
-					   system->particle_size);
+	priv->engine = particle_engine_new_deferred(system->particle_count,
+						    system->particle_size);
 
 	priv->particles = g_new0(struct particle, system->particle_count);
 
-	particle_engine_push_buffer(priv->engine,
-				    COGL_BUFFER_ACCESS_READ_WRITE, 0);
+	/* Each chunk of particles is created from a random stream of it's
+	 * own, so that large systems can be created in parallel, with one
+	 * worker per processor. */
+	priv->create_seed = g_rand_int(priv->rand);
 
-	for (i = 0; i < system->particle_count; i++)
-		create_particle(system, i);
+	pool = worker_pool_new(chunk_count > 1 ? 0 : 1);
+	worker_pool_run_chunks(pool, chunk_count, 1, create_particle_chunks,
+			       system);
+	worker_pool_free(pool);
+}
 
-	particle_engine_pop_buffer(priv->engine);
+static gpointer prepare_thread_main(gpointer data)
+{
+	create_state(data);
+
+	return NULL;
+}
+
+static void create_resources(struct particle_system *system)
+{
+	struct particle_system_priv *priv = system->priv;
+
+	if (priv->prepare_thread)
+		join_prepare_thread(system);
+	else
+		create_state(system);
+
+	/* Only uploading the vertices needs the render thread. */
+	particle_engine_realize(priv->engine, priv->ctx, priv->fb);
+}
+
+void particle_system_prepare(struct particle_system *system)
+{
+	struct particle_system_priv *priv = system->priv;
+
+	if (priv->prepare_thread || priv->engine)
+		return;
+
+	priv->prepare_thread = g_thread_new("particle-system-prepare",
+					    prepare_thread_main, system);
 }
 
 static void update_particle(struct particle_system *system,
@@ -187,11 +278,10 @@ static void update_particle(struct particle_system *system,
 static void tick(struct particle_system *system)
 {
 	struct particle_system_priv *priv = system->priv;
-	struct particle_engine *engine = priv->engine;
 	int i;
 
 	/* Create resources as necessary */
-	if (!engine)
+	if (priv->prepare_thread || !priv->engine)
 		create_resources(system);
 
 	/* Update the clocks */
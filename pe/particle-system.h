@@ -52,6 +52,15 @@ struct particle_system *particle_system_new(CoglContext *ctx, CoglFramebuffer *f
 
 void particle_system_free(struct particle_system *system);
 
+/*
+ * Start creating the system's particles on a background thread, so that the
+ * first paint only has to upload their vertices. Large systems are created in
+ * parallel. The system must be fully configured first, and must not be
+ * changed until it has been painted. Systems which are not prepared are
+ * created by their first paint, as before.
+ */
+void particle_system_prepare(struct particle_system *system);
+
 void particle_system_paint(struct particle_system *system);
 
 #endif /* _PARTICLE_SYSTEM_H_ */
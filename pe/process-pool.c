@@ -0,0 +1,248 @@
+#include "process-pool.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <semaphore.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+/* The alignment of the user's shared memory. */
+#define SHARED_ALIGNMENT 64
+
+/* The interval (in milliseconds) at which the creating process checks that
+ * the worker processes are still alive while it waits for them. */
+#define WORKER_CHECK_INTERVAL 100
+
+/*
+ * The start of the shared memory, which is used to control the pool. The
+ * user's shared memory follows it.
+ */
+struct control {
+	/* Set before the last start, to stop the worker processes. */
+	gboolean quit;
+
+	/* The current run. */
+	process_pool_func func;
+	gpointer data;
+
+	/* Each worker process posts done after each run. These are semaphores
+	 * rather than barriers so that the creating process can stop waiting
+	 * if a worker process dies. */
+	sem_t done;
+
+	/* The creating process posts the start of each worker process before
+	 * each run, indexed from 1. */
+	sem_t start[];
+};
+
+struct process_pool {
+	int process_count;
+
+	/* The worker processes, indexed from 1. */
+	pid_t *pids;
+
+	struct control *control;
+	size_t size;
+};
+
+static size_t get_control_size(int process_count)
+{
+	return (sizeof(struct control) + sizeof(sem_t) * process_count +
+		SHARED_ALIGNMENT - 1) / SHARED_ALIGNMENT * SHARED_ALIGNMENT;
+}
+
+/*
+ * Map a new block of POSIX shared memory. The name is unlinked as soon as the
+ * block is mapped, so the memory is freed once every process has unmapped it,
+ * however they exit.
+ */
+static gpointer map_shared(size_t size)
+{
+	static gint serial;
+	gchar *name;
+	gpointer memory;
+	int fd;
+
+	name = g_strdup_printf("/pe-%d-%d", (int)getpid(),
+			       g_atomic_int_add(&serial, 1));
+
+	fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, S_IRUSR | S_IWUSR);
+	if (fd < 0)
+		g_error(G_STRLOC " failed to create shared memory %s", name);
+
+	shm_unlink(name);
+	g_free(name);
+
+	if (ftruncate(fd, size))
+		g_error(G_STRLOC " failed to size shared memory");
+
+	memory = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+
+	if (memory == MAP_FAILED)
+		g_error(G_STRLOC " failed to map shared memory");
+
+	return memory;
+}
+
+static void worker_main(struct process_pool *pool, int process)
+{
+	struct control *control = pool->control;
+
+	while (TRUE) {
+		while (sem_wait(&control->start[process]) && errno == EINTR)
+			;
+
+		if (control->quit)
+			break;
+
+		control->func(control->data, process);
+
+		sem_post(&control->done);
+	}
+
+	/* Skip the creating process's exit handlers */
+	_exit(0);
+}
+
+/*
+ * Abort if any of the worker processes has exited, as the pool can't run
+ * without it.
+ */
+static void check_workers(struct process_pool *pool)
+{
+	int i, status;
+
+	for (i = 1; i < pool->process_count; i++) {
+		if (waitpid(pool->pids[i], &status, WNOHANG) != pool->pids[i])
+			continue;
+
+		if (WIFSIGNALED(status))
+			g_error(G_STRLOC " worker process %d killed by signal %d",
+				i, WTERMSIG(status));
+		else
+			g_error(G_STRLOC " worker process %d exited with status %d",
+				i, WEXITSTATUS(status));
+	}
+}
+
+/*
+ * Wait until every worker process has finished the current run, checking
+ * periodically that none of them have died.
+ */
+static void wait_workers(struct process_pool *pool)
+{
+	struct control *control = pool->control;
+	int i;
+
+	for (i = 1; i < pool->process_count; i++) {
+		while (TRUE) {
+			struct timespec timeout;
+
+			clock_gettime(CLOCK_REALTIME, &timeout);
+			timeout.tv_nsec += WORKER_CHECK_INTERVAL * 1000000L;
+			timeout.tv_sec += timeout.tv_nsec / 1000000000L;
+			timeout.tv_nsec %= 1000000000L;
+
+			if (!sem_timedwait(&control->done, &timeout))
+				break;
+
+			if (errno == ETIMEDOUT)
+				check_workers(pool);
+		}
+	}
+}
+
+struct process_pool *process_pool_new(int process_count, size_t shared_size)
+{
+	struct process_pool *pool = g_slice_new0(struct process_pool);
+	int i;
+
+	if (process_count < 1)
+		process_count = g_get_num_processors();
+
+	pool->process_count = process_count;
+	pool->pids = g_new0(pid_t, process_count);
+	pool->size = get_control_size(process_count) + shared_size;
+	pool->control = map_shared(pool->size);
+
+	if (sem_init(&pool->control->done, 1, 0))
+		g_error(G_STRLOC " failed to create semaphore");
+
+	for (i = 1; i < process_count; i++) {
+		if (sem_init(&pool->control->start[i], 1, 0))
+			g_error(G_STRLOC " failed to create semaphore");
+	}
+
+	/* Process 0 is the calling process, so doesn't need forking. */
+	for (i = 1; i < process_count; i++) {
+		pool->pids[i] = fork();
+
+		if (pool->pids[i] < 0)
+			g_error(G_STRLOC " failed to fork worker process");
+
+		if (pool->pids[i] == 0)
+			worker_main(pool, i);
+	}
+
+	return pool;
+}
+
+void process_pool_free(struct process_pool *pool)
+{
+	int i;
+
+	pool->control->quit = TRUE;
+
+	for (i = 1; i < pool->process_count; i++)
+		sem_post(&pool->control->start[i]);
+
+	for (i = 1; i < pool->process_count; i++) {
+		waitpid(pool->pids[i], NULL, 0);
+		sem_destroy(&pool->control->start[i]);
+	}
+
+	sem_destroy(&pool->control->done);
+	munmap(pool->control, pool->size);
+
+	g_free(pool->pids);
+	g_slice_free(struct process_pool, pool);
+}
+
+int process_pool_get_process_count(struct process_pool *pool)
+{
+	return pool->process_count;
+}
+
+gpointer process_pool_get_shared(struct process_pool *pool)
+{
+	return (guint8 *)pool->control + get_control_size(pool->process_count);
+}
+
+void process_pool_run(struct process_pool *pool, process_pool_func func,
+		      gpointer data)
+{
+	struct control *control = pool->control;
+	int i;
+
+	if (pool->process_count == 1) {
+		func(data, 0);
+		return;
+	}
+
+	control->func = func;
+	control->data = data;
+
+	for (i = 1; i < pool->process_count; i++)
+		sem_post(&control->start[i]);
+
+	/* Lend a hand */
+	func(data, 0);
+
+	wait_workers(pool);
+}
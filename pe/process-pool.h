@@ -0,0 +1,66 @@
+/*
+ *         process-pool.h -- A pool of processes sharing memory.
+ *
+ * A process pool forks a fixed set of worker processes which share a block of
+ * POSIX shared memory with the process that created the pool. Each run of the
+ * pool calls a function once in every process, including the calling process,
+ * and waits for all of them to return. Processes do not share a heap or a
+ * graphics context, so this scales past the limits of threads within a single
+ * process, at the cost of exchanging every piece of shared state through the
+ * shared memory.
+ *
+ * The worker processes are forked when the pool is created, so they see a copy
+ * of the creating process's memory as it was at that moment, and nothing that
+ * is written to it afterwards. Anything that changes between runs must be
+ * passed through the shared memory. Worker processes must not touch Cogl.
+ *
+ * The pool must be created before any threads are started by the creating
+ * process that the worker processes might depend on, such as the threads of a
+ * worker pool, as only the forking thread is copied into them.
+ */
+#ifndef _PROCESS_POOL_H_
+#define _PROCESS_POOL_H_
+
+#include <glib.h>
+
+/*
+ * The process pool is an opaque data structure
+ */
+struct process_pool;
+
+/*
+ * Run the share of a loop belonging to the given process, in the range [0,
+ * process count). The creating process is always process 0.
+ */
+typedef void (*process_pool_func)(gpointer data, int process);
+
+/*
+ * Create a pool of process_count processes (including the calling process)
+ * sharing shared_size bytes of zeroed memory, aligned to 64 bytes.
+ */
+struct process_pool *process_pool_new(int process_count, size_t shared_size);
+
+/*
+ * Stop the worker processes and free the pool.
+ */
+void process_pool_free(struct process_pool *pool);
+
+int process_pool_get_process_count(struct process_pool *pool);
+
+/*
+ * Return the shared memory, which is mapped at the same address in every
+ * process.
+ */
+gpointer process_pool_get_shared(struct process_pool *pool);
+
+/*
+ * Call func in every process, blocking until every process has returned.
+ * Since the worker processes are copies of the creating process, func and
+ * data must have been valid when the pool was created. This must only be
+ * called from the creating process. If a worker process dies, then the
+ * creating process aborts rather than waiting for it forever.
+ */
+void process_pool_run(struct process_pool *pool, process_pool_func func,
+		      gpointer data);
+
+#endif /* _PROCESS_POOL_H_ */
@@ -0,0 +1,101 @@
+#include "spatial-grid.h"
+
+#include <string.h>
+
+struct spatial_grid *spatial_grid_new(const float *min, const float *max,
+				      float cell_size, int max_cells)
+{
+	struct spatial_grid *grid = g_slice_new0(struct spatial_grid);
+	float volume = 1;
+	unsigned int i;
+
+	for (i = 0; i < 3; i++)
+		volume *= MAX(max[i] - min[i], cell_size);
+
+	/* Grow the cells until the grid fits within the cell budget. */
+	if (volume / (cell_size * cell_size * cell_size) > max_cells)
+		cell_size = cbrtf(volume / max_cells);
+
+	grid->cell_size = cell_size;
+	grid->inv_cell_size = 1.0f / cell_size;
+	grid->cell_count = 1;
+
+	for (i = 0; i < 3; i++) {
+		grid->origin[i] = min[i];
+		grid->dims[i] = MAX((int)ceilf((max[i] - min[i]) / cell_size), 1);
+		grid->cell_count *= grid->dims[i];
+	}
+
+	grid->cell_start = g_new0(int, grid->cell_count + 1);
+
+	return grid;
+}
+
+void spatial_grid_free(struct spatial_grid *grid)
+{
+	g_free(grid->cell_start);
+	g_free(grid->indices);
+	g_free(grid->particle_cell);
+
+	g_slice_free(struct spatial_grid, grid);
+}
+
+void spatial_grid_clear(struct spatial_grid *grid, int particle_count)
+{
+	if (particle_count > grid->particle_capacity) {
+		g_free(grid->indices);
+		g_free(grid->particle_cell);
+
+		grid->indices = g_new(int, particle_count);
+		grid->particle_cell = g_new(int, particle_count);
+		grid->particle_capacity = particle_count;
+	}
+
+	grid->particle_count = particle_count;
+	memset(grid->cell_start, 0, sizeof(int) * (grid->cell_count + 1));
+}
+
+void spatial_grid_insert(struct spatial_grid *grid, int index,
+			 const float *position)
+{
+	int cell;
+
+	cell = spatial_grid_get_cell(grid,
+				     spatial_grid_get_coord(grid, 0, position[0]),
+				     spatial_grid_get_coord(grid, 1, position[1]),
+				     spatial_grid_get_coord(grid, 2, position[2]));
+
+	grid->particle_cell[index] = cell;
+
+	/* Count the cell's population */
+	grid->cell_start[cell]++;
+}
+
+void spatial_grid_commit(struct spatial_grid *grid)
+{
+	int i;
+
+	/* Convert cell populations into end offsets */
+	for (i = 1; i < grid->cell_count; i++)
+		grid->cell_start[i] += grid->cell_start[i - 1];
+
+	grid->cell_start[grid->cell_count] = grid->particle_count;
+
+	/* Scatter particles into their cells, walking each cell's offset back
+	 * from its end to its start. Iterating in reverse index order keeps
+	 * the particles within each cell in index order. */
+	for (i = grid->particle_count - 1; i >= 0; i--)
+		grid->indices[--grid->cell_start[grid->particle_cell[i]]] = i;
+}
+
+void spatial_grid_get_range(const struct spatial_grid *grid,
+			    const float *position, float radius,
+			    int *lo, int *hi)
+{
+	unsigned int i;
+
+	for (i = 0; i < 3; i++) {
+		lo[i] = spatial_grid_get_coord(grid, i, position[i] - radius);
+		hi[i] = spatial_grid_get_coord(grid, i, position[i] + radius);
+	}
+}
@@ -0,0 +1,118 @@
+/*
+ *         spatial-grid.h -- A uniform grid for neighbour searches.
+ *
+ * The grid divides an axis-aligned bounding box into cubic cells, and bins
+ * particles into these cells by position. A search for the particles within a
+ * given radius of a point then only needs to visit the cells which overlap that
+ * radius, rather than every particle.
+ *
+ * Positions which fall outside of the bounding box are clamped into the
+ * outermost cells, so every particle is always binned. Clamping preserves
+ * adjacency, so a radius search which visits every overlapping cell will never
+ * miss a particle, no matter where it is.
+ *
+ * The grid is rebuilt by clearing it, inserting every particle and then
+ * committing the insertions:
+ *
+ *    spatial_grid_clear(grid, count);
+ *
+ *    for (i = 0; i < count; i++)
+ *            spatial_grid_insert(grid, i, position[i]);
+ *
+ *    spatial_grid_commit(grid);
+ *
+ * This is a counting sort, so a rebuild is O(n) in the number of particles.
+ */
+#ifndef _SPATIAL_GRID_H_
+#define _SPATIAL_GRID_H_
+
+#include <glib.h>
+#include <math.h>
+
+struct spatial_grid {
+	/* The minimum corner of the grid. */
+	float origin[3];
+
+	/* The length of the edge of a single cell, and it's reciprocal. */
+	float cell_size;
+	float inv_cell_size;
+
+	/* The number of cells along each axis, and in total. */
+	int dims[3];
+	int cell_count;
+
+	/* The offset of the first particle of each cell into the indices array.
+	 * The particles within cell c are indices[cell_start[c]] up to (but not
+	 * including) indices[cell_start[c + 1]]. */
+	int *cell_start;
+
+	/* Particle indices, sorted by cell. */
+	int *indices;
+
+	/* The cell of each particle, indexed by particle. */
+	int *particle_cell;
+
+	/* The number of particles in the grid, and the number of particles that
+	 * storage has been allocated for. */
+	int particle_count;
+	int particle_capacity;
+};
+
+/*
+ * Create a new grid spanning the bounding box [min, max] with cells of the
+ * requested size. If this would require more than max_cells cells, then the
+ * cell size is increased until it doesn't.
+ */
+struct spatial_grid *spatial_grid_new(const float *min, const float *max,
+				      float cell_size, int max_cells);
+
+void spatial_grid_free(struct spatial_grid *grid);
+
+/*
+ * Empty the grid, and prepare it to have particle_count particles inserted.
+ */
+void spatial_grid_clear(struct spatial_grid *grid, int particle_count);
+
+/*
+ * Bin a particle at the given position. Each index in the range [0,
+ * particle_count) must be inserted exactly once between clearing and
+ * committing the grid.
+ */
+void spatial_grid_insert(struct spatial_grid *grid, int index,
+			 const float *position);
+
+/*
+ * Sort the inserted particles by cell, ready for searching.
+ */
+void spatial_grid_commit(struct spatial_grid *grid);
+
+/*
+ * Return the cell coordinate along the given axis which contains the value x,
+ * clamped to the grid.
+ */
+static inline int spatial_grid_get_coord(const struct spatial_grid *grid,
+					 int axis, float x)
+{
+	int c = (int)floorf((x - grid->origin[axis]) * grid->inv_cell_size);
+
+	return CLAMP(c, 0, grid->dims[axis] - 1);
+}
+
+/*
+ * Return the index of the cell at the given cell coordinates.
+ */
+static inline int spatial_grid_get_cell(const struct spatial_grid *grid,
+					int x, int y, int z)
+{
+	return (z * grid->dims[1] + y) * grid->dims[0] + x;
+}
+
+/*
+ * Get the inclusive range of cell coordinates [lo, hi] which must be visited
+ * to find every particle within radius of position.
+ */
+void spatial_grid_get_range(const struct spatial_grid *grid,
+			    const float *position, float radius,
+			    int *lo, int *hi);
+
+#endif /* _SPATIAL_GRID_H_ */
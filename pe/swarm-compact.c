@@ -0,0 +1,241 @@
+#include "swarm-compact.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define HAVE_AVX2_KERNEL 1
+#include <immintrin.h>
+#endif
+
+/* The largest quantized position and size. */
+#define POSITION_STEPS 65535.0f
+#define SIZE_STEPS 255.0f
+
+#define SIZE_SCALE ((SWARM_MAX_PARTICLE_SIZE - SWARM_MIN_PARTICLE_SIZE) / SIZE_STEPS)
+
+/*
+ * Convert a float to a half precision float, rounding to nearest even. NaNs
+ * are not preserved, as particle velocities are never NaN.
+ */
+static guint16 float_to_half(float f)
+{
+	union { float f; guint32 u; } v;
+	guint16 sign;
+	float a = fabsf(f);
+
+	v.f = f;
+	sign = (v.u >> 16) & 0x8000;
+
+	/* Too large, round to infinity */
+	if (a >= 65520.0f)
+		return sign | 0x7c00;
+
+	/* Subnormal. The result may round up to the smallest normal, which
+	 * has the next encoding. */
+	if (a < 6.103515625e-05f)
+		return sign | (guint16)lrintf(a * 16777216.0f);
+
+	/* Normal. Rebias the exponent and drop the lower 13 bits of the
+	 * mantissa, rounding to nearest even. A carry out of the mantissa
+	 * correctly increments the exponent. */
+	v.u &= 0x7fffffff;
+	v.u += 0x0fff + ((v.u >> 13) & 1);
+
+	return sign | ((v.u - (112 << 23)) >> 13);
+}
+
+static inline float half_to_float(guint16 h)
+{
+	union { float f; guint32 u; } v;
+	guint32 exponent = (h >> 10) & 0x1f, mantissa = h & 0x3ff;
+
+	if (exponent == 0) {
+		/* Zero or subnormal */
+		v.f = ldexpf(mantissa, -24);
+		v.u |= (guint32)(h & 0x8000) << 16;
+	} else if (exponent == 0x1f) {
+		v.u = ((guint32)(h & 0x8000) << 16) | 0x7f800000 | (mantissa << 13);
+	} else {
+		v.u = ((guint32)(h & 0x8000) << 16) |
+			((exponent + 112) << 23) | (mantissa << 13);
+	}
+
+	return v.f;
+}
+
+void swarm_compact_arrays_init(struct swarm_compact_arrays *arrays,
+			       int particle_count,
+			       const float *min, const float *max)
+{
+	size_t stride, size;
+	unsigned int i;
+	guint8 *data;
+
+	/* Pad each array to a whole number of vectors, as for float arrays,
+	 * so that the SIMD kernel may load past the end of a range. */
+	stride = (MAX(particle_count, 1) + SWARM_VECTOR_WIDTH - 1) /
+		SWARM_VECTOR_WIDTH * SWARM_VECTOR_WIDTH;
+	size = stride * (6 * sizeof(guint16) + sizeof(guint8)) +
+		SWARM_VECTOR_WIDTH;
+
+	if (posix_memalign(&arrays->data, SWARM_ALIGNMENT, size))
+		g_error(G_STRLOC " failed to allocate particle arrays");
+
+	memset(arrays->data, 0, size);
+
+	data = arrays->data;
+	arrays->capacity = particle_count;
+
+	for (i = 0; i < 3; i++) {
+		arrays->position[i] = (guint16 *)(data + stride * sizeof(guint16) * i);
+		arrays->velocity[i] = (guint16 *)(data + stride * sizeof(guint16) * (3 + i));
+		arrays->origin[i] = min[i];
+		arrays->scale[i] = (max[i] - min[i]) / POSITION_STEPS;
+	}
+
+	arrays->size = data + stride * sizeof(guint16) * 6;
+}
+
+void swarm_compact_arrays_clear(struct swarm_compact_arrays *arrays)
+{
+	free(arrays->data);
+	memset(arrays, 0, sizeof(*arrays));
+}
+
+static inline guint16 quantize_position(const struct swarm_compact_arrays *arrays,
+					int j, float position)
+{
+	float x = (position - arrays->origin[j]) / arrays->scale[j];
+
+	return (guint16)(CLAMP(x, 0.0f, POSITION_STEPS) + 0.5f);
+}
+
+static inline guint8 quantize_size(float size)
+{
+	float x = (size - SWARM_MIN_PARTICLE_SIZE) / SIZE_SCALE;
+
+	return (guint8)(CLAMP(x, 0.0f, SIZE_STEPS) + 0.5f);
+}
+
+void swarm_compact_arrays_set(struct swarm_compact_arrays *arrays, int index,
+			      const struct swarm_arrays *src, int src_index)
+{
+	int j;
+
+	for (j = 0; j < 3; j++) {
+		arrays->position[j][index] = quantize_position(arrays, j,
+							       src->position[j][src_index]);
+		arrays->velocity[j][index] = float_to_half(src->velocity[j][src_index]);
+	}
+
+	arrays->size[index] = quantize_size(src->size[src_index]);
+}
+
+static inline float get_position(const struct swarm_compact_arrays *arrays,
+				 int j, int i)
+{
+	return arrays->origin[j] + arrays->position[j][i] * arrays->scale[j];
+}
+
+static inline float get_velocity(const struct swarm_compact_arrays *arrays,
+				 int j, int i)
+{
+	return half_to_float(arrays->velocity[j][i]);
+}
+
+static inline float get_size(const struct swarm_compact_arrays *arrays, int i)
+{
+	return SWARM_MIN_PARTICLE_SIZE + arrays->size[i] * SIZE_SCALE;
+}
+
+void swarm_compact_arrays_get(const struct swarm_compact_arrays *arrays,
+			      int index, float *position, float *velocity,
+			      float *size)
+{
+	int j;
+
+	for (j = 0; j < 3; j++) {
+		position[j] = get_position(arrays, j, index);
+		velocity[j] = get_velocity(arrays, j, index);
+	}
+
+	*size = get_size(arrays, index);
+}
+
+void swarm_compact_round_params(const struct swarm_compact_arrays *arrays,
+				struct swarm_kernel_params *params)
+{
+	int j;
+
+	for (j = 0; j < 3; j++) {
+		guint16 q = quantize_position(arrays, j, params->position[j]);
+
+		params->position[j] = arrays->origin[j] + q * arrays->scale[j];
+	}
+
+	params->size = SWARM_MIN_PARTICLE_SIZE +
+		quantize_size(params->size) * SIZE_SCALE;
+}
+
+#define KERNEL_ARRAYS struct swarm_compact_arrays
+#define KERNEL_TARGET "avx2,f16c"
+#define KERNEL_SUPPORTED() \
+	(__builtin_cpu_supports("avx2") && __builtin_cpu_supports("f16c"))
+
+#ifdef HAVE_AVX2_KERNEL
+
+/*
+ * Dequantize 8 positions along axis j, starting at index i.
+ */
+__attribute__((target("avx2,f16c")))
+static inline __m256 load_position_avx2(const struct swarm_compact_arrays *arrays,
+					int j, int i)
+{
+	__m256i q = _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i *)&arrays->position[j][i]));
+
+	return _mm256_add_ps(_mm256_set1_ps(arrays->origin[j]),
+			     _mm256_mul_ps(_mm256_cvtepi32_ps(q),
+					   _mm256_set1_ps(arrays->scale[j])));
+}
+
+__attribute__((target("avx2,f16c")))
+static inline __m256 load_velocity_avx2(const struct swarm_compact_arrays *arrays,
+					int j, int i)
+{
+	return _mm256_cvtph_ps(_mm_loadu_si128((const __m128i *)&arrays->velocity[j][i]));
+}
+
+__attribute__((target("avx2,f16c")))
+static inline __m256 load_size_avx2(const struct swarm_compact_arrays *arrays,
+				    int i)
+{
+	__m256i q = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)&arrays->size[i]));
+
+	return _mm256_add_ps(_mm256_set1_ps(SWARM_MIN_PARTICLE_SIZE),
+			     _mm256_mul_ps(_mm256_cvtepi32_ps(q),
+					   _mm256_set1_ps(SIZE_SCALE)));
+}
+
+#endif /* HAVE_AVX2_KERNEL */
+
+#include "swarm-kernel-impl.h"
+
+void swarm_kernel_accumulate_compact(const struct swarm_compact_arrays *arrays,
+				     int start, int end,
+				     const struct swarm_kernel_params *params,
+				     struct swarm_kernel_sums *sums)
+{
+	select_kernels();
+	accumulate(arrays, start, end, params, sums);
+}
+
+void swarm_kernel_accumulate_pairs_compact(const struct swarm_compact_arrays *arrays,
+					   int index, int start, int end,
+					   const struct swarm_kernel_params *params,
+					   struct swarm_sums *sums)
+{
+	select_kernels();
+	accumulate_pairs(arrays, index, start, end, params, sums);
+}
@@ -0,0 +1,486 @@
+/*
+ *         swarm-kernel-impl.h -- Interaction kernels for any particle storage.
+ *
+ * The interaction kernels only differ between the forms of particle storage in
+ * how they load the state of a particle, so they are written once here, and
+ * included by the file for each form of storage. That file must first define:
+ *
+ *    KERNEL_ARRAYS        the type of the particle arrays
+ *    KERNEL_TARGET        the target attribute of the SIMD kernels
+ *    KERNEL_SUPPORTED()   whether the processor supports the SIMD kernels
+ *    HAVE_AVX2_KERNEL     if the SIMD kernels can be built
+ *
+ * along with the functions which load the state of the particle at index i,
+ * where j is the axis:
+ *
+ *    get_position(arrays, j, i)
+ *    get_velocity(arrays, j, i)
+ *    get_size(arrays, i)
+ *    load_position_avx2(arrays, j, i)    8 particles from i on
+ *    load_velocity_avx2(arrays, j, i)
+ *    load_size_avx2(arrays, i)
+ *
+ * If KERNEL_HAVE_LIST is defined, then there is also a kernel for particles at
+ * scattered indices, which loads them with:
+ *
+ *    gather_position_avx2(arrays, j, indices)
+ *    gather_velocity_avx2(arrays, j, indices)
+ *    gather_size_avx2(arrays, indices)
+ *
+ * The including file gets static accumulate(), accumulate_pairs() and (if
+ * KERNEL_HAVE_LIST) accumulate_list() functions, which are set by
+ * select_kernels() to the fastest kernels that the processor supports. The
+ * kernels are described in swarm-kernel.h.
+ *
+ * This header is private, and must only be included once per file.
+ */
+
+typedef void (*accumulate_func)(const KERNEL_ARRAYS *arrays,
+				int start, int end,
+				const struct swarm_kernel_params *params,
+				struct swarm_kernel_sums *sums);
+
+#ifdef KERNEL_HAVE_LIST
+typedef void (*accumulate_list_func)(const KERNEL_ARRAYS *arrays,
+				     const int *indices, int count,
+				     const struct swarm_kernel_params *params,
+				     struct swarm_kernel_sums *sums);
+#endif
+
+typedef void (*accumulate_pairs_func)(const KERNEL_ARRAYS *arrays,
+				      int index, int start, int end,
+				      const struct swarm_kernel_params *params,
+				      struct swarm_sums *sums);
+
+/*
+ * Accumulate the influence of the particle at index i onto the sums.
+ */
+static inline void accumulate_particle(const KERNEL_ARRAYS *arrays, int i,
+				       const struct swarm_kernel_params *params,
+				       struct swarm_kernel_sums *sums)
+{
+	float x[3], d[3], distance2;
+	int j;
+
+	for (j = 0; j < 3; j++) {
+		x[j] = get_position(arrays, j, i);
+		d[j] = x[j] - params->position[j];
+	}
+
+	distance2 = d[0] * d[0] + d[1] * d[1] + d[2] * d[2];
+
+	if (distance2 < params->distance2) {
+		for (j = 0; j < 3; j++)
+			sums->separation[j] += d[j];
+	}
+
+	if (distance2 < params->sight2 && get_size(arrays, i) > params->size) {
+		for (j = 0; j < 3; j++) {
+			sums->position[j] += x[j];
+			sums->velocity[j] += get_velocity(arrays, j, i);
+		}
+		sums->flock_size++;
+	}
+}
+
+static void accumulate_scalar(const KERNEL_ARRAYS *arrays,
+			      int start, int end,
+			      const struct swarm_kernel_params *params,
+			      struct swarm_kernel_sums *sums)
+{
+	int i;
+
+	for (i = start; i < end; i++)
+		accumulate_particle(arrays, i, params, sums);
+}
+
+#ifdef KERNEL_HAVE_LIST
+static void accumulate_list_scalar(const KERNEL_ARRAYS *arrays,
+				   const int *indices, int count,
+				   const struct swarm_kernel_params *params,
+				   struct swarm_kernel_sums *sums)
+{
+	int n;
+
+	for (n = 0; n < count; n++)
+		accumulate_particle(arrays, indices[n], params, sums);
+}
+#endif /* KERNEL_HAVE_LIST */
+
+static void accumulate_pairs_scalar(const KERNEL_ARRAYS *arrays,
+				    int index, int start, int end,
+				    const struct swarm_kernel_params *params,
+				    struct swarm_sums *sums)
+{
+	const float *p = &params->position[0];
+	float velocity[3], s[3] = { 0 }, c[3] = { 0 }, v[3] = { 0 }, n = 0;
+	int i, j;
+
+	for (j = 0; j < 3; j++)
+		velocity[j] = get_velocity(arrays, j, index);
+
+	for (i = start; i < end; i++) {
+		float x[3], d[3], distance2, size;
+
+		for (j = 0; j < 3; j++) {
+			x[j] = get_position(arrays, j, i);
+			d[j] = x[j] - p[j];
+		}
+
+		distance2 = d[0] * d[0] + d[1] * d[1] + d[2] * d[2];
+
+		/* Separation is symmetric, so the other particle is pushed
+		 * away by the opposite offset. */
+		if (distance2 < params->distance2) {
+			for (j = 0; j < 3; j++) {
+				s[j] += d[j];
+				sums->separation[j][i] -= d[j];
+			}
+		}
+
+		/* Whichever of the pair is smaller follows the larger. */
+		if (distance2 < params->sight2) {
+			size = get_size(arrays, i);
+
+			if (size > params->size) {
+				for (j = 0; j < 3; j++) {
+					c[j] += x[j];
+					v[j] += get_velocity(arrays, j, i);
+				}
+				n++;
+			} else if (size < params->size) {
+				for (j = 0; j < 3; j++) {
+					sums->position[j][i] += p[j];
+					sums->velocity[j][i] += velocity[j];
+				}
+				sums->flock_size[i]++;
+			}
+		}
+	}
+
+	for (j = 0; j < 3; j++) {
+		sums->separation[j][index] += s[j];
+		sums->position[j][index] += c[j];
+		sums->velocity[j][index] += v[j];
+	}
+
+	sums->flock_size[index] += n;
+}
+
+#ifdef HAVE_AVX2_KERNEL
+
+__attribute__((target(KERNEL_TARGET)))
+static inline float hsum_avx2(__m256 v)
+{
+	__m128 x = _mm_add_ps(_mm256_castps256_ps128(v),
+			      _mm256_extractf128_ps(v, 1));
+
+	x = _mm_add_ps(x, _mm_movehl_ps(x, x));
+	x = _mm_add_ss(x, _mm_shuffle_ps(x, x, 1));
+
+	return _mm_cvtss_f32(x);
+}
+
+__attribute__((target(KERNEL_TARGET)))
+static void accumulate_avx2(const KERNEL_ARRAYS *arrays,
+			    int start, int end,
+			    const struct swarm_kernel_params *params,
+			    struct swarm_kernel_sums *sums)
+{
+	const __m256 px = _mm256_set1_ps(params->position[0]);
+	const __m256 py = _mm256_set1_ps(params->position[1]);
+	const __m256 pz = _mm256_set1_ps(params->position[2]);
+	const __m256 size = _mm256_set1_ps(params->size);
+	const __m256 distance2 = _mm256_set1_ps(params->distance2);
+	const __m256 sight2 = _mm256_set1_ps(params->sight2);
+	const __m256 one = _mm256_set1_ps(1.0f);
+	__m256 sx = _mm256_setzero_ps(), sy = sx, sz = sx;
+	__m256 cx = sx, cy = sx, cz = sx, vx = sx, vy = sx, vz = sx;
+	__m256 count = sx;
+	int i;
+
+	for (i = start; i + SWARM_VECTOR_WIDTH <= end; i += SWARM_VECTOR_WIDTH) {
+		__m256 x, y, z, dx, dy, dz, d2, separate, flock;
+
+		x = load_position_avx2(arrays, 0, i);
+		y = load_position_avx2(arrays, 1, i);
+		z = load_position_avx2(arrays, 2, i);
+
+		dx = _mm256_sub_ps(x, px);
+		dy = _mm256_sub_ps(y, py);
+		dz = _mm256_sub_ps(z, pz);
+
+		d2 = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(dx, dx),
+						 _mm256_mul_ps(dy, dy)),
+				   _mm256_mul_ps(dz, dz));
+
+		/* Separation, masked to the particles within the repulsion
+		 * distance. */
+		separate = _mm256_cmp_ps(d2, distance2, _CMP_LT_OQ);
+
+		sx = _mm256_add_ps(sx, _mm256_and_ps(separate, dx));
+		sy = _mm256_add_ps(sy, _mm256_and_ps(separate, dy));
+		sz = _mm256_add_ps(sz, _mm256_and_ps(separate, dz));
+
+		/* Cohesion and alignment, masked to the larger particles within
+		 * sight. Most particles are out of sight, so we only load the
+		 * sizes and velocities when some are within it. */
+		flock = _mm256_cmp_ps(d2, sight2, _CMP_LT_OQ);
+
+		if (!_mm256_movemask_ps(flock))
+			continue;
+
+		flock = _mm256_and_ps(flock, _mm256_cmp_ps(load_size_avx2(arrays, i),
+							   size, _CMP_GT_OQ));
+
+		cx = _mm256_add_ps(cx, _mm256_and_ps(flock, x));
+		cy = _mm256_add_ps(cy, _mm256_and_ps(flock, y));
+		cz = _mm256_add_ps(cz, _mm256_and_ps(flock, z));
+
+		vx = _mm256_add_ps(vx, _mm256_and_ps(flock, load_velocity_avx2(arrays, 0, i)));
+		vy = _mm256_add_ps(vy, _mm256_and_ps(flock, load_velocity_avx2(arrays, 1, i)));
+		vz = _mm256_add_ps(vz, _mm256_and_ps(flock, load_velocity_avx2(arrays, 2, i)));
+
+		count = _mm256_add_ps(count, _mm256_and_ps(flock, one));
+	}
+
+	sums->separation[0] += hsum_avx2(sx);
+	sums->separation[1] += hsum_avx2(sy);
+	sums->separation[2] += hsum_avx2(sz);
+	sums->position[0] += hsum_avx2(cx);
+	sums->position[1] += hsum_avx2(cy);
+	sums->position[2] += hsum_avx2(cz);
+	sums->velocity[0] += hsum_avx2(vx);
+	sums->velocity[1] += hsum_avx2(vy);
+	sums->velocity[2] += hsum_avx2(vz);
+	sums->flock_size += hsum_avx2(count);
+
+	/* Finish off any particles which don't fill a vector. */
+	accumulate_scalar(arrays, i, end, params, sums);
+}
+
+#ifdef KERNEL_HAVE_LIST
+__attribute__((target(KERNEL_TARGET)))
+static void accumulate_list_avx2(const KERNEL_ARRAYS *arrays,
+				 const int *indices, int count,
+				 const struct swarm_kernel_params *params,
+				 struct swarm_kernel_sums *sums)
+{
+	const __m256 px = _mm256_set1_ps(params->position[0]);
+	const __m256 py = _mm256_set1_ps(params->position[1]);
+	const __m256 pz = _mm256_set1_ps(params->position[2]);
+	const __m256 size = _mm256_set1_ps(params->size);
+	const __m256 distance2 = _mm256_set1_ps(params->distance2);
+	const __m256 sight2 = _mm256_set1_ps(params->sight2);
+	const __m256 one = _mm256_set1_ps(1.0f);
+	__m256 sx = _mm256_setzero_ps(), sy = sx, sz = sx;
+	__m256 cx = sx, cy = sx, cz = sx, vx = sx, vy = sx, vz = sx;
+	__m256 n = sx;
+	int i;
+
+	for (i = 0; i + SWARM_VECTOR_WIDTH <= count; i += SWARM_VECTOR_WIDTH) {
+		__m256i index = _mm256_loadu_si256((const __m256i *)&indices[i]);
+		__m256 x, y, z, dx, dy, dz, d2, separate, flock;
+
+		x = gather_position_avx2(arrays, 0, index);
+		y = gather_position_avx2(arrays, 1, index);
+		z = gather_position_avx2(arrays, 2, index);
+
+		dx = _mm256_sub_ps(x, px);
+		dy = _mm256_sub_ps(y, py);
+		dz = _mm256_sub_ps(z, pz);
+
+		d2 = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(dx, dx),
+						 _mm256_mul_ps(dy, dy)),
+				   _mm256_mul_ps(dz, dz));
+
+		separate = _mm256_cmp_ps(d2, distance2, _CMP_LT_OQ);
+
+		sx = _mm256_add_ps(sx, _mm256_and_ps(separate, dx));
+		sy = _mm256_add_ps(sy, _mm256_and_ps(separate, dy));
+		sz = _mm256_add_ps(sz, _mm256_and_ps(separate, dz));
+
+		flock = _mm256_cmp_ps(d2, sight2, _CMP_LT_OQ);
+
+		/* Gathers are expensive, so we only gather the sizes and
+		 * velocities when some of the particles are within sight. */
+		if (!_mm256_movemask_ps(flock))
+			continue;
+
+		flock = _mm256_and_ps(flock, _mm256_cmp_ps(gather_size_avx2(arrays, index),
+							   size, _CMP_GT_OQ));
+
+		cx = _mm256_add_ps(cx, _mm256_and_ps(flock, x));
+		cy = _mm256_add_ps(cy, _mm256_and_ps(flock, y));
+		cz = _mm256_add_ps(cz, _mm256_and_ps(flock, z));
+
+		vx = _mm256_add_ps(vx, _mm256_and_ps(flock, gather_velocity_avx2(arrays, 0, index)));
+		vy = _mm256_add_ps(vy, _mm256_and_ps(flock, gather_velocity_avx2(arrays, 1, index)));
+		vz = _mm256_add_ps(vz, _mm256_and_ps(flock, gather_velocity_avx2(arrays, 2, index)));
+
+		n = _mm256_add_ps(n, _mm256_and_ps(flock, one));
+	}
+
+	sums->separation[0] += hsum_avx2(sx);
+	sums->separation[1] += hsum_avx2(sy);
+	sums->separation[2] += hsum_avx2(sz);
+	sums->position[0] += hsum_avx2(cx);
+	sums->position[1] += hsum_avx2(cy);
+	sums->position[2] += hsum_avx2(cz);
+	sums->velocity[0] += hsum_avx2(vx);
+	sums->velocity[1] += hsum_avx2(vy);
+	sums->velocity[2] += hsum_avx2(vz);
+	sums->flock_size += hsum_avx2(n);
+
+	/* Finish off any particles which don't fill a vector. */
+	accumulate_list_scalar(arrays, indices + i, count - i, params, sums);
+}
+#endif /* KERNEL_HAVE_LIST */
+
+/*
+ * Add the masked lanes of v to the 8 floats at p.
+ */
+__attribute__((target(KERNEL_TARGET)))
+static inline void masked_add_avx2(float *p, __m256 mask, __m256 v)
+{
+	_mm256_storeu_ps(p, _mm256_add_ps(_mm256_loadu_ps(p),
+					  _mm256_and_ps(mask, v)));
+}
+
+__attribute__((target(KERNEL_TARGET)))
+static void accumulate_pairs_avx2(const KERNEL_ARRAYS *arrays,
+				  int index, int start, int end,
+				  const struct swarm_kernel_params *params,
+				  struct swarm_sums *sums)
+{
+	const __m256 px = _mm256_set1_ps(params->position[0]);
+	const __m256 py = _mm256_set1_ps(params->position[1]);
+	const __m256 pz = _mm256_set1_ps(params->position[2]);
+	const __m256 pvx = _mm256_set1_ps(get_velocity(arrays, 0, index));
+	const __m256 pvy = _mm256_set1_ps(get_velocity(arrays, 1, index));
+	const __m256 pvz = _mm256_set1_ps(get_velocity(arrays, 2, index));
+	const __m256 size = _mm256_set1_ps(params->size);
+	const __m256 distance2 = _mm256_set1_ps(params->distance2);
+	const __m256 sight2 = _mm256_set1_ps(params->sight2);
+	const __m256 one = _mm256_set1_ps(1.0f);
+	__m256 sx = _mm256_setzero_ps(), sy = sx, sz = sx;
+	__m256 cx = sx, cy = sx, cz = sx, vx = sx, vy = sx, vz = sx;
+	__m256 count = sx;
+	int i;
+
+	for (i = start; i + SWARM_VECTOR_WIDTH <= end; i += SWARM_VECTOR_WIDTH) {
+		__m256 x, y, z, dx, dy, dz, d2, separate, sight, other_size;
+
+		x = load_position_avx2(arrays, 0, i);
+		y = load_position_avx2(arrays, 1, i);
+		z = load_position_avx2(arrays, 2, i);
+
+		dx = _mm256_sub_ps(x, px);
+		dy = _mm256_sub_ps(y, py);
+		dz = _mm256_sub_ps(z, pz);
+
+		d2 = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(dx, dx),
+						 _mm256_mul_ps(dy, dy)),
+				   _mm256_mul_ps(dz, dz));
+
+		/* Separation is symmetric, so the other particles are pushed
+		 * away by the opposite offsets. Most particles are out of
+		 * range, so we skip the stores when no lanes are. */
+		separate = _mm256_cmp_ps(d2, distance2, _CMP_LT_OQ);
+
+		if (_mm256_movemask_ps(separate)) {
+			sx = _mm256_add_ps(sx, _mm256_and_ps(separate, dx));
+			sy = _mm256_add_ps(sy, _mm256_and_ps(separate, dy));
+			sz = _mm256_add_ps(sz, _mm256_and_ps(separate, dz));
+
+			masked_add_avx2(&sums->separation[0][i], separate,
+					_mm256_sub_ps(px, x));
+			masked_add_avx2(&sums->separation[1][i], separate,
+					_mm256_sub_ps(py, y));
+			masked_add_avx2(&sums->separation[2][i], separate,
+					_mm256_sub_ps(pz, z));
+		}
+
+		sight = _mm256_cmp_ps(d2, sight2, _CMP_LT_OQ);
+
+		if (_mm256_movemask_ps(sight)) {
+			__m256 follow, lead;
+
+			/* Whichever of each pair is smaller follows the
+			 * larger. */
+			other_size = load_size_avx2(arrays, i);
+			follow = _mm256_and_ps(sight, _mm256_cmp_ps(other_size, size, _CMP_GT_OQ));
+			lead = _mm256_and_ps(sight, _mm256_cmp_ps(other_size, size, _CMP_LT_OQ));
+
+			cx = _mm256_add_ps(cx, _mm256_and_ps(follow, x));
+			cy = _mm256_add_ps(cy, _mm256_and_ps(follow, y));
+			cz = _mm256_add_ps(cz, _mm256_and_ps(follow, z));
+
+			vx = _mm256_add_ps(vx, _mm256_and_ps(follow, load_velocity_avx2(arrays, 0, i)));
+			vy = _mm256_add_ps(vy, _mm256_and_ps(follow, load_velocity_avx2(arrays, 1, i)));
+			vz = _mm256_add_ps(vz, _mm256_and_ps(follow, load_velocity_avx2(arrays, 2, i)));
+
+			count = _mm256_add_ps(count, _mm256_and_ps(follow, one));
+
+			if (_mm256_movemask_ps(lead)) {
+				masked_add_avx2(&sums->position[0][i], lead, px);
+				masked_add_avx2(&sums->position[1][i], lead, py);
+				masked_add_avx2(&sums->position[2][i], lead, pz);
+				masked_add_avx2(&sums->velocity[0][i], lead, pvx);
+				masked_add_avx2(&sums->velocity[1][i], lead, pvy);
+				masked_add_avx2(&sums->velocity[2][i], lead, pvz);
+				masked_add_avx2(&sums->flock_size[i], lead, one);
+			}
+		}
+	}
+
+	sums->separation[0][index] += hsum_avx2(sx);
+	sums->separation[1][index] += hsum_avx2(sy);
+	sums->separation[2][index] += hsum_avx2(sz);
+	sums->position[0][index] += hsum_avx2(cx);
+	sums->position[1][index] += hsum_avx2(cy);
+	sums->position[2][index] += hsum_avx2(cz);
+	sums->velocity[0][index] += hsum_avx2(vx);
+	sums->velocity[1][index] += hsum_avx2(vy);
+	sums->velocity[2][index] += hsum_avx2(vz);
+	sums->flock_size[index] += hsum_avx2(count);
+
+	/* Finish off any particles which don't fill a vector. */
+	accumulate_pairs_scalar(arrays, index, i, end, params, sums);
+}
+
+#endif /* HAVE_AVX2_KERNEL */
+
+static accumulate_func accumulate;
+#ifdef KERNEL_HAVE_LIST
+static accumulate_list_func accumulate_list;
+#endif
+static accumulate_pairs_func accumulate_pairs;
+
+static void select_kernels(void)
+{
+	static gsize initialised;
+
+	if (!g_once_init_enter(&initialised))
+		return;
+
+	accumulate = accumulate_scalar;
+#ifdef KERNEL_HAVE_LIST
+	accumulate_list = accumulate_list_scalar;
+#endif
+	accumulate_pairs = accumulate_pairs_scalar;
+
+#ifdef HAVE_AVX2_KERNEL
+	__builtin_cpu_init();
+
+	if (KERNEL_SUPPORTED()) {
+		accumulate = accumulate_avx2;
+#ifdef KERNEL_HAVE_LIST
+		accumulate_list = accumulate_list_avx2;
+#endif
+		accumulate_pairs = accumulate_pairs_avx2;
+	}
+#endif
+
+	g_once_init_leave(&initialised, 1);
+}
@@ -0,0 +1,203 @@
+#include "swarm-kernel.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define HAVE_AVX2_KERNEL 1
+#include <immintrin.h>
+#endif
+
+/*
+ * Return the stride between arrays of particle_count floats. Each array is
+ * padded to a whole number of vectors, so that every array starts on an
+ * aligned boundary.
+ */
+static size_t get_stride(int particle_count)
+{
+	return (MAX(particle_count, 1) + SWARM_VECTOR_WIDTH - 1) /
+		SWARM_VECTOR_WIDTH * SWARM_VECTOR_WIDTH;
+}
+
+/*
+ * Allocate array_count zeroed arrays of particle_count floats in a single
+ * block, and return the block and the stride between arrays.
+ */
+static float *alloc_arrays(int particle_count, int array_count,
+			   size_t *stride)
+{
+	size_t size;
+	void *data;
+
+	*stride = get_stride(particle_count);
+	size = sizeof(float) * *stride * array_count;
+
+	if (posix_memalign(&data, SWARM_ALIGNMENT, size))
+		g_error(G_STRLOC " failed to allocate particle arrays");
+
+	memset(data, 0, size);
+
+	return data;
+}
+
+/*
+ * Point the arrays into a block of 8 arrays with the given stride.
+ */
+static void set_arrays(struct swarm_arrays *arrays, int particle_count,
+		       float *data, size_t stride)
+{
+	unsigned int i;
+
+	arrays->capacity = particle_count;
+
+	for (i = 0; i < 3; i++) {
+		arrays->position[i] = data + stride * i;
+		arrays->velocity[i] = data + stride * (3 + i);
+	}
+
+	arrays->speed = data + stride * 6;
+	arrays->size = data + stride * 7;
+}
+
+void swarm_arrays_init(struct swarm_arrays *arrays, int particle_count)
+{
+	size_t stride;
+
+	arrays->data = alloc_arrays(particle_count, 8, &stride);
+	set_arrays(arrays, particle_count, arrays->data, stride);
+}
+
+size_t swarm_arrays_get_size(int particle_count)
+{
+	return sizeof(float) * get_stride(particle_count) * 8;
+}
+
+void swarm_arrays_init_with_data(struct swarm_arrays *arrays,
+				 int particle_count, void *data)
+{
+	set_arrays(arrays, particle_count, data, get_stride(particle_count));
+	arrays->data = NULL;
+}
+
+void swarm_arrays_clear(struct swarm_arrays *arrays)
+{
+	free(arrays->data);
+	memset(arrays, 0, sizeof(*arrays));
+}
+
+void swarm_sums_init(struct swarm_sums *sums, int particle_count)
+{
+	size_t stride;
+	unsigned int i;
+
+	sums->data = alloc_arrays(particle_count, 10, &stride);
+	sums->capacity = particle_count;
+
+	for (i = 0; i < 3; i++) {
+		sums->separation[i] = sums->data + stride * i;
+		sums->position[i] = sums->data + stride * (3 + i);
+		sums->velocity[i] = sums->data + stride * (6 + i);
+	}
+
+	sums->flock_size = sums->data + stride * 9;
+}
+
+void swarm_sums_clear(struct swarm_sums *sums)
+{
+	free(sums->data);
+	memset(sums, 0, sizeof(*sums));
+}
+
+#define KERNEL_ARRAYS struct swarm_arrays
+#define KERNEL_TARGET "avx2"
+#define KERNEL_SUPPORTED() __builtin_cpu_supports("avx2")
+#define KERNEL_HAVE_LIST 1
+
+static inline float get_position(const struct swarm_arrays *arrays, int j, int i)
+{
+	return arrays->position[j][i];
+}
+
+static inline float get_velocity(const struct swarm_arrays *arrays, int j, int i)
+{
+	return arrays->velocity[j][i];
+}
+
+static inline float get_size(const struct swarm_arrays *arrays, int i)
+{
+	return arrays->size[i];
+}
+
+#ifdef HAVE_AVX2_KERNEL
+
+__attribute__((target("avx2")))
+static inline __m256 load_position_avx2(const struct swarm_arrays *arrays,
+					int j, int i)
+{
+	return _mm256_loadu_ps(&arrays->position[j][i]);
+}
+
+__attribute__((target("avx2")))
+static inline __m256 load_velocity_avx2(const struct swarm_arrays *arrays,
+					int j, int i)
+{
+	return _mm256_loadu_ps(&arrays->velocity[j][i]);
+}
+
+__attribute__((target("avx2")))
+static inline __m256 load_size_avx2(const struct swarm_arrays *arrays, int i)
+{
+	return _mm256_loadu_ps(&arrays->size[i]);
+}
+
+__attribute__((target("avx2")))
+static inline __m256 gather_position_avx2(const struct swarm_arrays *arrays,
+					  int j, __m256i indices)
+{
+	return _mm256_i32gather_ps(arrays->position[j], indices, 4);
+}
+
+__attribute__((target("avx2")))
+static inline __m256 gather_velocity_avx2(const struct swarm_arrays *arrays,
+					  int j, __m256i indices)
+{
+	return _mm256_i32gather_ps(arrays->velocity[j], indices, 4);
+}
+
+__attribute__((target("avx2")))
+static inline __m256 gather_size_avx2(const struct swarm_arrays *arrays,
+				      __m256i indices)
+{
+	return _mm256_i32gather_ps(arrays->size, indices, 4);
+}
+
+#endif /* HAVE_AVX2_KERNEL */
+
+#include "swarm-kernel-impl.h"
+
+void swarm_kernel_accumulate(const struct swarm_arrays *arrays,
+			     int start, int end,
+			     const struct swarm_kernel_params *params,
+			     struct swarm_kernel_sums *sums)
+{
+	select_kernels();
+	accumulate(arrays, start, end, params, sums);
+}
+
+void swarm_kernel_accumulate_list(const struct swarm_arrays *arrays,
+				  const int *indices, int count,
+				  const struct swarm_kernel_params *params,
+				  struct swarm_kernel_sums *sums)
+{
+	select_kernels();
+	accumulate_list(arrays, indices, count, params, sums);
+}
+
+void swarm_kernel_accumulate_pairs(const struct swarm_arrays *arrays,
+				   int index, int start, int end,
+				   const struct swarm_kernel_params *params,
+				   struct swarm_sums *sums)
+{
+	select_kernels();
+	accumulate_pairs(arrays, index, start, end, params, sums);
+}
@@ -0,0 +1,166 @@
+/*
+ *         swarm-kernel.h -- Particle swarm interaction kernels.
+ *
+ * The interactions between particles in a swarm are the most expensive part of
+ * a tick, so the swarm keeps it's particle state in a structure of arrays,
+ * where each component of each property has an array of it's own. This allows
+ * the kernel to process the interactions between a particle and many other
+ * particles at once using SIMD instructions.
+ *
+ * On x86 processors which support AVX2, the kernel processes 8 particles at a
+ * time. Otherwise it falls back to a scalar implementation. The choice is made
+ * at runtime, so the same library works on any processor.
+ */
+#ifndef _SWARM_KERNEL_H_
+#define _SWARM_KERNEL_H_
+
+#include <glib.h>
+
+/* The alignment (in bytes) of particle arrays. */
+#define SWARM_ALIGNMENT 32
+
+/* The number of floats in a SIMD vector. Particle arrays are padded to a
+ * multiple of this length. */
+#define SWARM_VECTOR_WIDTH 8
+
+/* The range of particle sizes. */
+#define SWARM_MIN_PARTICLE_SIZE 0.5f
+#define SWARM_MAX_PARTICLE_SIZE 1.5f
+
+/*
+ * Particle state in structure of arrays form.
+ */
+struct swarm_arrays {
+	float *position[3];
+	float *velocity[3];
+	float *speed;
+	float *size;
+
+	/* The number of particles that the arrays can hold. */
+	int capacity;
+
+	/* The storage that the arrays point into, or NULL if the arrays do not
+	 * own their storage. */
+	float *data;
+};
+
+/*
+ * Allocate storage for particle_count particles, with every value zeroed.
+ */
+void swarm_arrays_init(struct swarm_arrays *arrays, int particle_count);
+
+/*
+ * Free the storage of a set of particle arrays.
+ */
+void swarm_arrays_clear(struct swarm_arrays *arrays);
+
+/*
+ * Return the size (in bytes) of the storage of arrays for particle_count
+ * particles.
+ */
+size_t swarm_arrays_get_size(int particle_count);
+
+/*
+ * Point the arrays into storage which was allocated by the caller, such as
+ * shared memory. The storage must be at least swarm_arrays_get_size() bytes,
+ * aligned to SWARM_ALIGNMENT, and is not freed by swarm_arrays_clear().
+ */
+void swarm_arrays_init_with_data(struct swarm_arrays *arrays,
+				 int particle_count, void *data);
+
+/*
+ * The properties of the particle whose neighbours are being visited.
+ */
+struct swarm_kernel_params {
+	float position[3];
+	float size;
+
+	/* The squared distance at which particles repel each-other. */
+	float distance2;
+
+	/* The squared distance that particles can see other particles. Zero
+	 * disables flocking. */
+	float sight2;
+};
+
+/*
+ * The totals accumulated over the neighbours of a particle.
+ */
+struct swarm_kernel_sums {
+	/* The sum of the offsets from the particle to each neighbour which is
+	 * closer than the repulsion distance. */
+	float separation[3];
+
+	/* The sum of the positions and velocities of each neighbour which is
+	 * within sight and larger than the particle, and the number of them.
+	 * Approximate methods may count a fraction of a particle. */
+	float position[3];
+	float velocity[3];
+	float flock_size;
+};
+
+/*
+ * The totals accumulated over the neighbours of every particle, in structure
+ * of arrays form. The fields have the same meaning as swarm_kernel_sums.
+ */
+struct swarm_sums {
+	float *separation[3];
+	float *position[3];
+	float *velocity[3];
+	float *flock_size;
+
+	/* The number of particles that the arrays can hold. */
+	int capacity;
+
+	/* The storage that the arrays point into. */
+	float *data;
+};
+
+/*
+ * Allocate storage for the sums of particle_count particles, with every value
+ * zeroed.
+ */
+void swarm_sums_init(struct swarm_sums *sums, int particle_count);
+
+/*
+ * Free the storage of a set of sums.
+ */
+void swarm_sums_clear(struct swarm_sums *sums);
+
+/*
+ * Accumulate the influence of the particles in the range [start, end) of the
+ * arrays onto the sums. The particle itself may be included in the range, as
+ * it has no influence on itself.
+ */
+void swarm_kernel_accumulate(const struct swarm_arrays *arrays,
+			     int start, int end,
+			     const struct swarm_kernel_params *params,
+			     struct swarm_kernel_sums *sums);
+
+/*
+ * Accumulate the influence of the count particles with the given indices onto
+ * the sums. The same as swarm_kernel_accumulate(), but for particles which
+ * are scattered through the arrays.
+ */
+void swarm_kernel_accumulate_list(const struct swarm_arrays *arrays,
+				  const int *indices, int count,
+				  const struct swarm_kernel_params *params,
+				  struct swarm_kernel_sums *sums);
+
+/*
+ * Accumulate the interactions between the particle at index and each of the
+ * particles in the range [start, end) of the arrays, in both directions. The
+ * influence of the other particles is added to sums at index, and the
+ * influence of the particle on each of the others is added to sums at their
+ * indices. The params must describe the particle at index, and the range must
+ * not include it.
+ *
+ * Visiting each pair of particles once in this way halves the number of
+ * distances that must be computed.
+ */
+void swarm_kernel_accumulate_pairs(const struct swarm_arrays *arrays,
+				   int index, int start, int end,
+				   const struct swarm_kernel_params *params,
+				   struct swarm_sums *sums);
+
+#endif /* _SWARM_KERNEL_H_ */
@@ -0,0 +1,484 @@
+#include "swarm-octree.h"
+
+#include "morton.h"
+
+#include <string.h>
+
+/* The maximum number of particles in a leaf node. */
+#define LEAF_SIZE 16
+
+/* Nodes with no more than this many particles are never opened or
+ * approximated. It is cheaper to pass their particles to the interaction
+ * kernel in a single range than to traverse their subtree. */
+#define KERNEL_RANGE_SIZE 128
+
+/* The maximum depth of the traversal stack. Each level of the tree can leave
+ * at most 7 siblings on the stack. */
+#define STACK_SIZE (8 * (MORTON_BITS + 1))
+
+/* The width of each size class. */
+#define SIZE_CLASS_WIDTH ((SWARM_MAX_PARTICLE_SIZE - SWARM_MIN_PARTICLE_SIZE) / \
+			  SWARM_OCTREE_SIZE_CLASSES)
+
+static int get_size_class(float size)
+{
+	int c = (int)((size - SWARM_MIN_PARTICLE_SIZE) / SIZE_CLASS_WIDTH);
+
+	return CLAMP(c, 0, SWARM_OCTREE_SIZE_CLASSES - 1);
+}
+
+struct swarm_octree *swarm_octree_new(int particle_count)
+{
+	struct swarm_octree *tree = g_slice_new0(struct swarm_octree);
+
+	tree->codes = g_new(guint32, particle_count);
+	tree->indices = g_new(int, particle_count);
+	tree->slots = g_new(int, particle_count);
+	tree->scratch_codes = g_new(guint32, particle_count);
+	tree->scratch_indices = g_new(int, particle_count);
+
+	swarm_arrays_init(&tree->sorted, particle_count);
+
+	/* A reasonable first guess, the node array grows as required. */
+	tree->node_capacity = MAX(particle_count / LEAF_SIZE * 2, 1);
+	tree->nodes = g_new(struct swarm_octree_node, tree->node_capacity);
+
+	return tree;
+}
+
+void swarm_octree_free(struct swarm_octree *tree)
+{
+	g_free(tree->codes);
+	g_free(tree->indices);
+	g_free(tree->slots);
+	g_free(tree->scratch_codes);
+	g_free(tree->scratch_indices);
+	g_free(tree->nodes);
+
+	swarm_arrays_clear(&tree->sorted);
+
+	g_slice_free(struct swarm_octree, tree);
+}
+
+/*
+ * Reserve count consecutive nodes, and return the index of the first.
+ */
+static int reserve_nodes(struct swarm_octree *tree, int count)
+{
+	int first = tree->node_count;
+
+	tree->node_count += count;
+
+	if (tree->node_count > tree->node_capacity) {
+		tree->node_capacity = MAX(tree->node_capacity * 2,
+					  tree->node_count);
+		tree->nodes = g_renew(struct swarm_octree_node, tree->nodes,
+				      tree->node_capacity);
+	}
+
+	return first;
+}
+
+static void init_leaf(struct swarm_octree *tree,
+		      struct swarm_octree_node *node)
+{
+	const struct swarm_arrays *sorted = &tree->sorted;
+	int i, j;
+
+	for (j = 0; j < 3; j++) {
+		node->min[j] = G_MAXFLOAT;
+		node->max[j] = -G_MAXFLOAT;
+	}
+
+	for (i = node->start; i < node->end; i++) {
+		int c = get_size_class(sorted->size[i]);
+
+		for (j = 0; j < 3; j++) {
+			float x = sorted->position[j][i];
+
+			node->min[j] = MIN(node->min[j], x);
+			node->max[j] = MAX(node->max[j], x);
+			node->position[c][j] += x;
+			node->velocity[c][j] += sorted->velocity[j][i];
+		}
+
+		node->count[c]++;
+	}
+}
+
+/*
+ * Derive the extent and center of mass of a node from it's bounding box and
+ * sums.
+ */
+static void finish_node(struct swarm_octree_node *node)
+{
+	float count = 0;
+	int j, k;
+
+	node->extent = 0;
+
+	for (j = 0; j < 3; j++) {
+		node->extent = MAX(node->extent, node->max[j] - node->min[j]);
+		node->center_of_mass[j] = 0;
+	}
+
+	for (k = 0; k < SWARM_OCTREE_SIZE_CLASSES; k++) {
+		for (j = 0; j < 3; j++)
+			node->center_of_mass[j] += node->position[k][j];
+		count += node->count[k];
+	}
+
+	for (j = 0; j < 3; j++)
+		node->center_of_mass[j] /= count;
+}
+
+/*
+ * Fill in the node at the given index with the particles in the range [start,
+ * end), which all share the same octant at every level above this one.
+ */
+static void build_node(struct swarm_octree *tree, int index,
+		       int start, int end, int level)
+{
+	struct swarm_octree_node *node = &tree->nodes[index];
+	int i, j, c, first_child, child_count = 0, shift;
+
+	memset(node, 0, sizeof(*node));
+	node->start = start;
+	node->end = end;
+
+	if (end - start <= LEAF_SIZE || level == MORTON_BITS) {
+		init_leaf(tree, node);
+		finish_node(node);
+		return;
+	}
+
+	/* The particles are sorted by code, so the particles in each child
+	 * octant are contiguous. Count the non-empty octants: */
+	shift = 3 * (MORTON_BITS - 1 - level);
+
+	for (i = start; i < end; i++) {
+		if (i == start || ((tree->codes[i] ^ tree->codes[i - 1]) >> shift) & 7)
+			child_count++;
+	}
+
+	/* Reserving nodes may move the node array, so we refer to nodes by
+	 * index from here on. */
+	first_child = reserve_nodes(tree, child_count);
+
+	tree->nodes[index].first_child = first_child;
+	tree->nodes[index].child_count = child_count;
+
+	for (i = start, c = 0; c < child_count; c++) {
+		int child_start = i;
+
+		for (i++; i < end; i++) {
+			if (((tree->codes[i] ^ tree->codes[i - 1]) >> shift) & 7)
+				break;
+		}
+
+		build_node(tree, first_child + c, child_start, i, level + 1);
+	}
+
+	/* Sum up the children */
+	node = &tree->nodes[index];
+
+	for (j = 0; j < 3; j++) {
+		node->min[j] = G_MAXFLOAT;
+		node->max[j] = -G_MAXFLOAT;
+	}
+
+	for (c = 0; c < child_count; c++) {
+		const struct swarm_octree_node *child = &tree->nodes[first_child + c];
+		int k;
+
+		for (j = 0; j < 3; j++) {
+			node->min[j] = MIN(node->min[j], child->min[j]);
+			node->max[j] = MAX(node->max[j], child->max[j]);
+		}
+
+		for (k = 0; k < SWARM_OCTREE_SIZE_CLASSES; k++) {
+			for (j = 0; j < 3; j++) {
+				node->position[k][j] += child->position[k][j];
+				node->velocity[k][j] += child->velocity[k][j];
+			}
+
+			node->count[k] += child->count[k];
+		}
+	}
+
+	finish_node(node);
+}
+
+void swarm_octree_build(struct swarm_octree *tree,
+			const struct swarm_arrays *particles,
+			int particle_count,
+			const float *min, const float *size)
+{
+	struct swarm_arrays *sorted = &tree->sorted;
+	int i, j;
+
+	tree->particle_count = particle_count;
+	tree->node_count = 0;
+
+	for (i = 0; i < particle_count; i++) {
+		float position[3];
+
+		for (j = 0; j < 3; j++)
+			position[j] = particles->position[j][i];
+
+		tree->codes[i] = morton_encode(position, min, size);
+		tree->indices[i] = i;
+	}
+
+	morton_sort(tree->codes, tree->indices, particle_count,
+		    tree->scratch_codes, tree->scratch_indices);
+
+	/* Gather the particles into tree order */
+	for (i = 0; i < particle_count; i++) {
+		int index = tree->indices[i];
+
+		tree->slots[index] = i;
+
+		for (j = 0; j < 3; j++) {
+			sorted->position[j][i] = particles->position[j][index];
+			sorted->velocity[j][i] = particles->velocity[j][index];
+		}
+
+		sorted->size[i] = particles->size[index];
+	}
+
+	build_node(tree, reserve_nodes(tree, 1), 0, particle_count, 0);
+}
+
+/*
+ * Add the particles of a node which are larger than the given size to the
+ * flocking sums.
+ */
+static void node_accumulate(const struct swarm_octree_node *node, float size,
+			    struct swarm_kernel_sums *sums)
+{
+	int c = get_size_class(size), k, j;
+	float upper, fraction;
+
+	/* The fraction of the particle's own class which is larger than it */
+	upper = SWARM_MIN_PARTICLE_SIZE + (c + 1) * SIZE_CLASS_WIDTH;
+	fraction = CLAMP((upper - size) / SIZE_CLASS_WIDTH, 0.0f, 1.0f);
+
+	for (k = c; k < SWARM_OCTREE_SIZE_CLASSES; k++) {
+		float weight = k == c ? fraction : 1.0f;
+
+		for (j = 0; j < 3; j++) {
+			sums->position[j] += node->position[k][j] * weight;
+			sums->velocity[j] += node->velocity[k][j] * weight;
+		}
+
+		sums->flock_size += node->count[k] * weight;
+	}
+}
+
+void swarm_octree_accumulate(const struct swarm_octree *tree,
+			     const struct swarm_kernel_params *params,
+			     float theta,
+			     struct swarm_kernel_sums *sums)
+{
+	const float *p = &params->position[0];
+	float reach2 = MAX(params->sight2, params->distance2);
+	float theta2 = theta * theta;
+	int stack[STACK_SIZE], top = 0;
+
+	if (tree->particle_count < 1)
+		return;
+
+	stack[top++] = 0;
+
+	while (top > 0) {
+		const struct swarm_octree_node *node = &tree->nodes[stack[--top]];
+		float near2 = 0, far2 = 0, d2 = 0;
+		int j;
+
+		/* The squared distances to the nearest and furthest points of
+		 * the node's bounding box, and to it's center of mass. */
+		for (j = 0; j < 3; j++) {
+			float lo = node->min[j] - p[j], hi = p[j] - node->max[j];
+			float d = MAX(MAX(lo, hi), 0);
+			float f = MAX(-lo, -hi);
+			float c = node->center_of_mass[j] - p[j];
+
+			near2 += d * d;
+			far2 += f * f;
+			d2 += c * c;
+		}
+
+		/* Out of reach */
+		if (near2 >= reach2)
+			continue;
+
+		/* A distant node which can't repel the particle is treated as
+		 * a single particle at it's center of mass. */
+		if (near2 >= params->distance2 &&
+		    node->extent * node->extent < theta2 * d2) {
+			if (d2 < params->sight2)
+				node_accumulate(node, params->size, sums);
+			continue;
+		}
+
+		/* If the node is entirely within reach, then every particle in
+		 * it would be visited anyway, so we visit them all at once. The
+		 * same goes for small nodes. */
+		if (far2 < reach2 || node->child_count == 0 ||
+		    node->end - node->start <= KERNEL_RANGE_SIZE) {
+			swarm_kernel_accumulate(&tree->sorted,
+						node->start, node->end,
+						params, sums);
+			continue;
+		}
+
+		for (j = 0; j < node->child_count; j++)
+			stack[top++] = node->first_child + j;
+	}
+}
+
+/*
+ * Return the squared distance from a position to the nearest point of a
+ * node's bounding box.
+ */
+static float get_near_distance2(const struct swarm_octree_node *node,
+				const float *p)
+{
+	float near2 = 0;
+	int j;
+
+	for (j = 0; j < 3; j++) {
+		float d = MAX(MAX(node->min[j] - p[j], p[j] - node->max[j]), 0);
+
+		near2 += d * d;
+	}
+
+	return near2;
+}
+
+/*
+ * Insert a particle into a list of the nearest particles found so far, which
+ * is sorted by distance and holds at most k particles.
+ */
+static void insert_nearest(int *nearest, float *nearest_distance2,
+			   int *count, int k, int slot, float distance2)
+{
+	int i;
+
+	if (*count == k && distance2 >= nearest_distance2[k - 1])
+		return;
+
+	if (*count < k)
+		(*count)++;
+
+	for (i = *count - 1; i > 0 && nearest_distance2[i - 1] > distance2; i--) {
+		nearest[i] = nearest[i - 1];
+		nearest_distance2[i] = nearest_distance2[i - 1];
+	}
+
+	nearest[i] = slot;
+	nearest_distance2[i] = distance2;
+}
+
+/*
+ * Add the particles in the range [start, end) of the sorted particles, other
+ * than the particle at slot, to the list of the nearest particles found so
+ * far.
+ */
+static void find_nearest_range(const struct swarm_octree *tree,
+			       int slot, int start, int end, int k,
+			       int *nearest, float *nearest_distance2,
+			       int *count)
+{
+	const struct swarm_arrays *sorted = &tree->sorted;
+	int i, j;
+
+	for (i = start; i < end; i++) {
+		float d[3];
+
+		if (i == slot)
+			continue;
+
+		for (j = 0; j < 3; j++)
+			d[j] = sorted->position[j][i] - sorted->position[j][slot];
+
+		insert_nearest(nearest, nearest_distance2, count, k, i,
+			       d[0] * d[0] + d[1] * d[1] + d[2] * d[2]);
+	}
+}
+
+int swarm_octree_find_nearest(const struct swarm_octree *tree, int index,
+			      int k, int *nearest, float *nearest_distance2)
+{
+	const struct swarm_arrays *sorted = &tree->sorted;
+	int stack[STACK_SIZE], top = 0, count = 0, slot, start, end, j;
+	float stack_near2[STACK_SIZE], position[3];
+
+	if (tree->particle_count < 2 || k < 1)
+		return 0;
+
+	slot = tree->slots[index];
+
+	for (j = 0; j < 3; j++)
+		position[j] = sorted->position[j][slot];
+
+	/* Particles which are near in Morton order are near in space, so the
+	 * particles either side of this one give a first guess at the
+	 * nearest, and the search below only has to visit the nodes which
+	 * could hold nearer particles. */
+	start = MAX(slot - k, 0);
+	end = MIN(slot + k + 1, tree->particle_count);
+	find_nearest_range(tree, slot, start, end, k,
+			   nearest, nearest_distance2, &count);
+
+	stack[top] = 0;
+	stack_near2[top++] = 0;
+
+	while (top > 0) {
+		const struct swarm_octree_node *node;
+		int base, c, i;
+
+		top--;
+
+		/* Further than the furthest neighbour found so far */
+		if (count == k && stack_near2[top] >= nearest_distance2[k - 1])
+			continue;
+
+		node = &tree->nodes[stack[top]];
+
+		/* The particles around this one have already been visited */
+		if (node->child_count == 0) {
+			find_nearest_range(tree, slot, node->start,
+					   MIN(node->end, start), k, nearest,
+					   nearest_distance2, &count);
+			find_nearest_range(tree, slot, MAX(node->start, end),
+					   node->end, k, nearest,
+					   nearest_distance2, &count);
+			continue;
+		}
+
+		/* Push the children which may hold nearer particles, furthest
+		 * first, so that the nearest is visited next and the list of
+		 * neighbours shrinks quickly. */
+		base = top;
+
+		for (c = 0; c < node->child_count; c++) {
+			float near2 = get_near_distance2(&tree->nodes[node->first_child + c],
+							 position);
+
+			if (count == k && near2 >= nearest_distance2[k - 1])
+				continue;
+
+			for (i = top++; i > base && stack_near2[i - 1] < near2; i--) {
+				stack[i] = stack[i - 1];
+				stack_near2[i] = stack_near2[i - 1];
+			}
+
+			stack[i] = node->first_child + c;
+			stack_near2[i] = near2;
+		}
+	}
+
+	return count;
+}
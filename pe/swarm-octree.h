@@ -0,0 +1,115 @@
+/*
+ *         swarm-octree.h -- Barnes-Hut approximation of swarm interactions.
+ *
+ * The octree recursively divides the particles of a swarm into octants. Each
+ * node of the tree stores the summed positions and velocities, and the number,
+ * of the particles in it's subtree, so that a distant group of particles can
+ * be treated as a single particle at it's center of mass.
+ *
+ * A node is treated as a single particle when it is small relative to it's
+ * distance from the particle being updated. The opening angle theta sets the
+ * threshold: a node of extent l at distance d is accepted when l / d < theta.
+ * An opening angle of zero never accepts a node, and gives the same results as
+ * visiting every particle. Nodes which overlap the repulsion distance of the
+ * particle are always opened, so separation is always exact.
+ *
+ * Flocking particles only follow particles which are larger than themselves,
+ * so the sums of each node are further divided into size classes. A particle
+ * takes every class that is larger than it, and the fraction of it's own class
+ * that would be larger if the sizes within the class were evenly spread.
+ *
+ * The tree also finds the nearest neighbours of a particle. A leaf holds at
+ * most a handful of particles however densely they are packed, so the search
+ * only visits the leaves around the particle, and it's cost depends on the
+ * number of neighbours rather than on the density of the swarm.
+ */
+#ifndef _SWARM_OCTREE_H_
+#define _SWARM_OCTREE_H_
+
+#include "swarm-kernel.h"
+
+/* The number of size classes that the sums of each node are divided into. */
+#define SWARM_OCTREE_SIZE_CLASSES 4
+
+struct swarm_octree_node {
+	/* The bounding box of the particles within the node, and the length of
+	 * it's longest edge. */
+	float min[3];
+	float max[3];
+	float extent;
+
+	/* The center of mass of the particles within the node. */
+	float center_of_mass[3];
+
+	/* The range of the node's particles in the sorted particle arrays. */
+	int start;
+	int end;
+
+	/* The index of the node's first child, and the number of children,
+	 * which are stored consecutively. Leaves have no children. */
+	int first_child;
+	int child_count;
+
+	/* The summed positions, velocities and count of the particles in the
+	 * subtree, by size class. */
+	float position[SWARM_OCTREE_SIZE_CLASSES][3];
+	float velocity[SWARM_OCTREE_SIZE_CLASSES][3];
+	float count[SWARM_OCTREE_SIZE_CLASSES];
+};
+
+struct swarm_octree {
+	/* The nodes of the tree. The root is the first node. */
+	struct swarm_octree_node *nodes;
+	int node_count;
+	int node_capacity;
+
+	/* A copy of the particles, sorted so that the particles of each node
+	 * are contiguous. */
+	struct swarm_arrays sorted;
+	int particle_count;
+
+	/* The Morton code and index of each particle, in sorted order, and
+	 * scratch space for sorting them. */
+	guint32 *codes;
+	int *indices;
+
+	/* The position of each particle in sorted order, by index. */
+	int *slots;
+	guint32 *scratch_codes;
+	int *scratch_indices;
+};
+
+struct swarm_octree *swarm_octree_new(int particle_count);
+
+void swarm_octree_free(struct swarm_octree *tree);
+
+/*
+ * Rebuild the tree from the first particle_count particles of the given
+ * arrays. The bounding box [min, min + size] is only used to order the
+ * particles, so particles outside of it are still included.
+ */
+void swarm_octree_build(struct swarm_octree *tree,
+			const struct swarm_arrays *particles,
+			int particle_count,
+			const float *min, const float *size);
+
+/*
+ * Accumulate the influence of the particles in the tree onto the sums, using
+ * an opening angle of theta.
+ */
+void swarm_octree_accumulate(const struct swarm_octree *tree,
+			     const struct swarm_kernel_params *params,
+			     float theta,
+			     struct swarm_kernel_sums *sums);
+
+/*
+ * Find the k nearest particles in the tree to the particle at index of the
+ * arrays that the tree was built from. The neighbours are written to nearest
+ * as indices into the tree's sorted particles, in order of distance, and their
+ * squared distances to nearest_distance2. Returns the number of neighbours
+ * found, which is only less than k if there are no more particles.
+ */
+int swarm_octree_find_nearest(const struct swarm_octree *tree, int index,
+			      int k, int *nearest, float *nearest_distance2);
+
+#endif /* _SWARM_OCTREE_H_ */
@@ -0,0 +1,260 @@
+#include "swarm-snapshot.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define SNAPSHOT_MAGIC "PESWARM"
+#define SNAPSHOT_VERSION 1
+
+/* Written as a native integer, to detect files from machines of the other
+ * byte order. */
+#define SNAPSHOT_BYTE_ORDER 0x01020304
+
+/* The alignment of each section of the file. This is at least SWARM_ALIGNMENT,
+ * so that the particle arrays can be used where they are mapped. */
+#define SNAPSHOT_ALIGNMENT 64
+
+struct header {
+	char magic[8];
+	guint32 version;
+	guint32 byte_order;
+
+	gint32 particle_count;
+
+	/* The number of floats between the starts of successive particle
+	 * arrays. */
+	guint32 stride;
+
+	guint32 create_seed;
+	gint32 tick_count;
+	gint32 ticks_since_reorder;
+
+	guint64 colors_offset;
+	guint64 buffers_offset;
+	guint64 size;
+};
+
+static guint64 align(guint64 offset)
+{
+	return (offset + SNAPSHOT_ALIGNMENT - 1) /
+		SNAPSHOT_ALIGNMENT * SNAPSHOT_ALIGNMENT;
+}
+
+static guint32 get_stride(int particle_count)
+{
+	return swarm_arrays_get_size(particle_count) / (sizeof(float) * 8);
+}
+
+/*
+ * Fill in the layout of a snapshot of particle_count particles.
+ */
+static void init_header(struct header *header, int particle_count)
+{
+	memset(header, 0, sizeof(*header));
+	memcpy(header->magic, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC));
+	header->version = SNAPSHOT_VERSION;
+	header->byte_order = SNAPSHOT_BYTE_ORDER;
+
+	header->particle_count = particle_count;
+	header->stride = get_stride(particle_count);
+
+	header->colors_offset = align(sizeof(*header));
+	header->buffers_offset = align(header->colors_offset + sizeof(float) *
+				       4 * particle_count);
+	header->size = header->buffers_offset +
+		swarm_arrays_get_size(particle_count) * 2;
+}
+
+/*
+ * Write a block of data, followed by zeroes up to the given offset.
+ */
+static gboolean write_block(FILE *file, const void *data, size_t size,
+			    guint64 end)
+{
+	static const char zeroes[SNAPSHOT_ALIGNMENT * 4];
+	guint64 padding;
+
+	if (size && fwrite(data, size, 1, file) != 1)
+		return FALSE;
+
+	padding = end - ftello(file);
+
+	while (padding > 0) {
+		size_t count = MIN(padding, sizeof(zeroes));
+
+		if (fwrite(zeroes, count, 1, file) != 1)
+			return FALSE;
+
+		padding -= count;
+	}
+
+	return TRUE;
+}
+
+static gboolean write_arrays(FILE *file, const struct swarm_arrays *arrays,
+			     int particle_count, guint32 stride)
+{
+	const float *values[8] = {
+		arrays->position[0], arrays->position[1], arrays->position[2],
+		arrays->velocity[0], arrays->velocity[1], arrays->velocity[2],
+		arrays->speed, arrays->size
+	};
+	unsigned int i;
+
+	for (i = 0; i < G_N_ELEMENTS(values); i++) {
+		if (!write_block(file, values[i], sizeof(float) * particle_count,
+				 ftello(file) + sizeof(float) * stride))
+			return FALSE;
+	}
+
+	return TRUE;
+}
+
+gboolean swarm_snapshot_save(const struct swarm_snapshot *snapshot,
+			     const char *filename)
+{
+	struct header header;
+	gchar *temp_name;
+	gboolean written;
+	FILE *file;
+	int i;
+
+	init_header(&header, snapshot->particle_count);
+	header.create_seed = snapshot->create_seed;
+	header.tick_count = snapshot->tick_count;
+	header.ticks_since_reorder = snapshot->ticks_since_reorder;
+
+	temp_name = g_strdup_printf("%s.tmp", filename);
+
+	file = fopen(temp_name, "wb");
+	if (!file) {
+		g_warning(G_STRLOC " failed to create %s: %s", temp_name,
+			  g_strerror(errno));
+		g_free(temp_name);
+		return FALSE;
+	}
+
+	written = write_block(file, &header, sizeof(header),
+			      header.colors_offset) &&
+		write_block(file, snapshot->colors, sizeof(float) * 4 *
+			    snapshot->particle_count, header.buffers_offset);
+
+	for (i = 0; i < 2 && written; i++)
+		written = write_arrays(file, &snapshot->buffers[i],
+				       snapshot->particle_count, header.stride);
+
+	if (fclose(file))
+		written = FALSE;
+
+	if (written && rename(temp_name, filename))
+		written = FALSE;
+
+	if (!written) {
+		g_warning(G_STRLOC " failed to write %s: %s", filename,
+			  g_strerror(errno));
+		unlink(temp_name);
+	}
+
+	g_free(temp_name);
+
+	return written;
+}
+
+/*
+ * Check that a mapped file is a snapshot which can be used in place.
+ */
+static gboolean check_header(const struct header *header, size_t size)
+{
+	struct header expected;
+
+	if (size < sizeof(*header) ||
+	    memcmp(header->magic, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC)))
+		return FALSE;
+
+	if (header->version != SNAPSHOT_VERSION ||
+	    header->byte_order != SNAPSHOT_BYTE_ORDER ||
+	    header->particle_count < 1)
+		return FALSE;
+
+	init_header(&expected, header->particle_count);
+
+	return header->stride == expected.stride &&
+		header->colors_offset == expected.colors_offset &&
+		header->buffers_offset == expected.buffers_offset &&
+		header->size == expected.size && size >= expected.size;
+}
+
+struct swarm_snapshot *swarm_snapshot_load(const char *filename)
+{
+	struct swarm_snapshot *snapshot;
+	const struct header *header;
+	struct stat st;
+	char *mapping;
+	size_t buffer_size;
+	int fd, i;
+
+	fd = open(filename, O_RDONLY);
+	if (fd < 0) {
+		g_warning(G_STRLOC " failed to open %s: %s", filename,
+			  g_strerror(errno));
+		return NULL;
+	}
+
+	if (fstat(fd, &st) || st.st_size == 0) {
+		g_warning(G_STRLOC " failed to read %s", filename);
+		close(fd);
+		return NULL;
+	}
+
+	/* A private mapping lets the swarm write to the particles, without
+	 * changing the file. Only the pages which are written are copied. */
+	mapping = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE,
+		       fd, 0);
+	close(fd);
+
+	if (mapping == MAP_FAILED) {
+		g_warning(G_STRLOC " failed to map %s: %s", filename,
+			  g_strerror(errno));
+		return NULL;
+	}
+
+	header = (const struct header *)mapping;
+
+	if (!check_header(header, st.st_size)) {
+		g_warning(G_STRLOC " %s is not a swarm snapshot of version %d",
+			  filename, SNAPSHOT_VERSION);
+		munmap(mapping, st.st_size);
+		return NULL;
+	}
+
+	snapshot = g_slice_new0(struct swarm_snapshot);
+	snapshot->particle_count = header->particle_count;
+	snapshot->create_seed = header->create_seed;
+	snapshot->tick_count = header->tick_count;
+	snapshot->ticks_since_reorder = header->ticks_since_reorder;
+	snapshot->colors = (float *)(mapping + header->colors_offset);
+
+	buffer_size = swarm_arrays_get_size(header->particle_count);
+
+	for (i = 0; i < 2; i++)
+		swarm_arrays_init_with_data(&snapshot->buffers[i],
+					    header->particle_count,
+					    mapping + header->buffers_offset +
+					    buffer_size * i);
+
+	snapshot->mapping = mapping;
+	snapshot->size = st.st_size;
+
+	return snapshot;
+}
+
+void swarm_snapshot_free(struct swarm_snapshot *snapshot)
+{
+	munmap(snapshot->mapping, snapshot->size);
+	g_slice_free(struct swarm_snapshot, snapshot);
+}
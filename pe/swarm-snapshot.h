@@ -0,0 +1,76 @@
+/*
+ *         swarm-snapshot.h -- Checkpoints of a swarm's particles.
+ *
+ * A flock takes several seconds of simulated time to settle from the random
+ * state that it's particles are created in. A snapshot saves the state of
+ * every particle to a file, so that a swarm can later be started from where
+ * it left off.
+ *
+ * The file is laid out so that it can be used in place. A snapshot is loaded
+ * by mapping the file into memory, checking the header, and pointing the
+ * particle arrays straight into the mapping, so no particle is parsed or
+ * converted. The swarm still copies each particle's color into it's vertices,
+ * and uploads them, when it is created. The file is mapped privately, so the
+ * swarm can write to the arrays without changing the file.
+ *
+ * The format, in the byte order of the machine that wrote it:
+ *
+ *    header   the magic, version, particle count and layout
+ *    colors   4 floats (red, green, blue, alpha) per particle
+ *    buffers  two sets of particle arrays: the state at the last tick,
+ *             followed by the state at the tick before (which the swarm
+ *             draws between)
+ *
+ * Each set of particle arrays is in the layout of swarm_arrays_init_with_data()
+ * (positions, velocities, speed, then size), with each array padded to a whole
+ * number of SIMD vectors. Every section starts on a 64 byte boundary. The
+ * version is bumped whenever the format changes, and files with a different
+ * version, byte order or padding are rejected.
+ */
+#ifndef _SWARM_SNAPSHOT_H_
+#define _SWARM_SNAPSHOT_H_
+
+#include "swarm-kernel.h"
+
+struct swarm_snapshot {
+	int particle_count;
+
+	/* The seed of the random streams that the particles were created
+	 * from, the number of ticks that the swarm had run, and the number
+	 * since it's particles were last reordered. */
+	guint32 create_seed;
+	int tick_count;
+	int ticks_since_reorder;
+
+	/* The red, green, blue and alpha of each particle. */
+	float *colors;
+
+	/* The particle state at the last tick, then the tick before. */
+	struct swarm_arrays buffers[2];
+
+	/* The mapped file that a loaded snapshot points into. */
+	void *mapping;
+	size_t size;
+};
+
+/*
+ * Write a snapshot to a file. The file is written under a temporary name and
+ * renamed into place once complete, so an existing snapshot is never left half
+ * written. Returns FALSE (with a warning) if the file couldn't be written.
+ */
+gboolean swarm_snapshot_save(const struct swarm_snapshot *snapshot,
+			     const char *filename);
+
+/*
+ * Map a snapshot file. Returns NULL (with a warning) if the file can't be read
+ * or isn't a snapshot of the current version.
+ */
+struct swarm_snapshot *swarm_snapshot_load(const char *filename);
+
+/*
+ * Unmap a loaded snapshot. Anything pointing into it's arrays must be done
+ * with them.
+ */
+void swarm_snapshot_free(struct swarm_snapshot *snapshot);
+
+#endif /* _SWARM_SNAPSHOT_H_ */
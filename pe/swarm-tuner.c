@@ -0,0 +1,295 @@
+#include "swarm-tuner.h"
+
+#include <math.h>
+#include <stdarg.h>
+
+/* The number of ticks that a candidate runs for before it is timed, which
+ * covers rebuilding any structures that depend on it. */
+#define SETTLE_TICKS 2
+
+/* The least and most number of ticks that a candidate is timed over, which is
+ * also the length of each window of ticks watched once tuned. */
+#define MIN_SAMPLE_TICKS 15
+#define MAX_SAMPLE_TICKS 200
+
+/* The number of windows in a row whose mean must drift past the threshold
+ * before retuning. */
+#define DRIFT_WINDOWS 4
+
+struct parameter {
+	const char *name;
+
+	float values[SWARM_TUNER_MAX_VALUES];
+	int value_count;
+
+	/* The index of the value in use, and the mean tick time of each value
+	 * when it was last timed. */
+	int current;
+	double times[SWARM_TUNER_MAX_VALUES];
+};
+
+struct swarm_tuner {
+	struct parameter parameters[SWARM_TUNER_MAX_PARAMETERS];
+	int parameter_count;
+
+	float threshold;
+	swarm_tuner_log_func log;
+	gpointer log_data;
+
+	/* Whether candidates are being timed, and if so the parameter being
+	 * tuned. Otherwise, the tick time is being watched for drift. */
+	gboolean tuning;
+	int parameter;
+
+	/* The number of ticks that each candidate or window is timed over,
+	 * the ticks run by the current one, and the total time of those
+	 * which have been sampled. */
+	int sample_ticks;
+	int tick;
+	double sample_time;
+
+	/* The tick time when last tuned, and the number of windows in a row
+	 * that have drifted from it. */
+	double tuned_time;
+	int drift_count;
+
+	/* The total number of ticks spent tuning, for logging. */
+	int tuning_ticks;
+};
+
+static void log_message(struct swarm_tuner *tuner, const char *format, ...)
+{
+	gchar *message;
+	va_list args;
+
+	if (!tuner->log)
+		return;
+
+	va_start(args, format);
+	message = g_strdup_vprintf(format, args);
+	va_end(args);
+
+	tuner->log(message, tuner->log_data);
+	g_free(message);
+}
+
+struct swarm_tuner *swarm_tuner_new(float threshold, swarm_tuner_log_func log,
+				    gpointer data)
+{
+	struct swarm_tuner *tuner = g_slice_new0(struct swarm_tuner);
+
+	tuner->threshold = threshold;
+	tuner->sample_ticks = MIN_SAMPLE_TICKS;
+	tuner->log = log;
+	tuner->log_data = data;
+
+	tuner->tuning = TRUE;
+	tuner->parameter = -1;
+
+	return tuner;
+}
+
+void swarm_tuner_free(struct swarm_tuner *tuner)
+{
+	g_slice_free(struct swarm_tuner, tuner);
+}
+
+int swarm_tuner_add_parameter(struct swarm_tuner *tuner, const char *name,
+			      const float *values, int count)
+{
+	struct parameter *parameter;
+	int i, j;
+
+	g_return_val_if_fail(tuner->parameter_count < SWARM_TUNER_MAX_PARAMETERS,
+			     -1);
+
+	parameter = &tuner->parameters[tuner->parameter_count];
+	parameter->name = name;
+
+	for (i = 0; i < count; i++) {
+		for (j = 0; j < parameter->value_count; j++) {
+			if (parameter->values[j] == values[i])
+				break;
+		}
+
+		if (j == parameter->value_count &&
+		    parameter->value_count < SWARM_TUNER_MAX_VALUES)
+			parameter->values[parameter->value_count++] = values[i];
+	}
+
+	return tuner->parameter_count++;
+}
+
+void swarm_tuner_set_period(struct swarm_tuner *tuner, int ticks)
+{
+	tuner->sample_ticks = CLAMP(MAX(ticks, tuner->sample_ticks),
+				    MIN_SAMPLE_TICKS, MAX_SAMPLE_TICKS);
+}
+
+float swarm_tuner_get_value(struct swarm_tuner *tuner, int parameter)
+{
+	const struct parameter *p = &tuner->parameters[parameter];
+
+	return p->values[p->current];
+}
+
+/*
+ * Log the times of every value of the parameter that has just been tuned, and
+ * the value chosen.
+ */
+static void log_parameter(struct swarm_tuner *tuner,
+			  const struct parameter *parameter)
+{
+	GString *times = g_string_new(NULL);
+	int i;
+
+	for (i = 0; i < parameter->value_count; i++)
+		g_string_append_printf(times, "%s%g (%.3f ms)", i ? ", " : "",
+				       parameter->values[i],
+				       parameter->times[i] * 1000);
+
+	log_message(tuner, "%s: %s; chose %g", parameter->name, times->str,
+		    parameter->values[parameter->current]);
+
+	g_string_free(times, TRUE);
+}
+
+/*
+ * Move on to the next parameter which has a choice of values, or stop tuning
+ * if there are none left. Returns TRUE if a value has changed.
+ */
+static gboolean next_parameter(struct swarm_tuner *tuner)
+{
+	struct parameter *parameter;
+	GString *values;
+	int i;
+
+	tuner->tick = 0;
+
+	while (++tuner->parameter < tuner->parameter_count) {
+		parameter = &tuner->parameters[tuner->parameter];
+
+		if (parameter->value_count > 1) {
+			gboolean changed = parameter->current != 0;
+
+			parameter->current = 0;
+			return changed;
+		}
+	}
+
+	tuner->tuning = FALSE;
+	tuner->drift_count = 0;
+
+	values = g_string_new(NULL);
+
+	for (i = 0; i < tuner->parameter_count; i++) {
+		parameter = &tuner->parameters[i];
+		g_string_append_printf(values, "%s%s = %g", i ? ", " : "",
+				       parameter->name,
+				       parameter->values[parameter->current]);
+	}
+
+	log_message(tuner, "tuned in %d ticks: %s", tuner->tuning_ticks,
+		    values->str);
+	g_string_free(values, TRUE);
+
+	return FALSE;
+}
+
+/*
+ * Record the time of a tick while tuning.
+ */
+static gboolean report_tuning(struct swarm_tuner *tuner, double tick_time)
+{
+	struct parameter *parameter;
+	int i, best;
+
+	tuner->tuning_ticks++;
+
+	/* The parameters are added before the first tick, which starts
+	 * tuning the first of them. */
+	if (tuner->parameter < 0)
+		return next_parameter(tuner);
+
+	if (tuner->tick++ < SETTLE_TICKS)
+		return FALSE;
+
+	if (tuner->tick == SETTLE_TICKS + 1)
+		tuner->sample_time = 0;
+
+	tuner->sample_time += tick_time;
+
+	if (tuner->tick < SETTLE_TICKS + tuner->sample_ticks)
+		return FALSE;
+
+	parameter = &tuner->parameters[tuner->parameter];
+	parameter->times[parameter->current] = tuner->sample_time /
+		tuner->sample_ticks;
+	tuner->tick = 0;
+
+	/* Time the next value. */
+	if (++parameter->current < parameter->value_count)
+		return TRUE;
+
+	for (i = 1, best = 0; i < parameter->value_count; i++) {
+		if (parameter->times[i] < parameter->times[best])
+			best = i;
+	}
+
+	parameter->current = best;
+	tuner->tuned_time = parameter->times[best];
+	log_parameter(tuner, parameter);
+
+	next_parameter(tuner);
+	return TRUE;
+}
+
+/*
+ * Record the time of a tick once tuned, and start tuning again if the tick
+ * time has drifted.
+ */
+static gboolean report_watching(struct swarm_tuner *tuner, double tick_time)
+{
+	double mean;
+
+	/* Nothing to tune. */
+	if (tuner->tuned_time <= 0)
+		return FALSE;
+
+	if (tuner->tick++ == 0)
+		tuner->sample_time = 0;
+
+	tuner->sample_time += tick_time;
+
+	if (tuner->tick < tuner->sample_ticks)
+		return FALSE;
+
+	tuner->tick = 0;
+	mean = tuner->sample_time / tuner->sample_ticks;
+
+	if (fabs(mean - tuner->tuned_time) > tuner->threshold *
+	    tuner->tuned_time)
+		tuner->drift_count++;
+	else
+		tuner->drift_count = 0;
+
+	if (tuner->drift_count < DRIFT_WINDOWS)
+		return FALSE;
+
+	log_message(tuner, "tick time drifted from %.3f ms to %.3f ms, retuning",
+		    tuner->tuned_time * 1000, mean * 1000);
+
+	tuner->tuning = TRUE;
+	tuner->tuning_ticks = 0;
+	tuner->parameter = -1;
+
+	return next_parameter(tuner);
+}
+
+gboolean swarm_tuner_report(struct swarm_tuner *tuner, double tick_time)
+{
+	if (tuner->tuning)
+		return report_tuning(tuner, tick_time);
+	else
+		return report_watching(tuner, tick_time);
+}
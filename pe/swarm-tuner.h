@@ -0,0 +1,83 @@
+/*
+ *         swarm-tuner.h -- Automatic tuning of swarm parameters.
+ *
+ * The fastest settings for a swarm's acceleration structures depend on the
+ * number of particles, how far they can see and how tightly they cluster,
+ * which differ from one swarm to the next and change over the life of a
+ * swarm. A tuner times a swarm's ticks under candidate values of a set of
+ * parameters, and settles on the fastest.
+ *
+ * Parameters are tuned one at a time, holding the others at their best values
+ * so far, so the number of candidates timed is the sum of the number of values
+ * of each parameter rather than their product. Each candidate runs for a few
+ * ticks to settle before it is timed, and is scored by the mean of it's tick
+ * times over a window. Some parameters trade the cost of periodic work, such
+ * as rebuilding a structure, against the cost of the ticks in between, so the
+ * window is made long enough to include that work for every candidate.
+ *
+ * Once tuned, the tuner keeps watching the tick time. If the mean over a
+ * window of ticks strays from the tuned time by more than a threshold for
+ * several windows in a row, for example because the particles have gathered
+ * into a tight flock, then the parameters are tuned again.
+ *
+ * The tuner only chooses values, which the caller applies. Parameters must
+ * only affect the speed of a tick, and not it's results.
+ */
+#ifndef _SWARM_TUNER_H_
+#define _SWARM_TUNER_H_
+
+#include <glib.h>
+
+/* The maximum number of parameters, and of values of each parameter. */
+#define SWARM_TUNER_MAX_PARAMETERS 8
+#define SWARM_TUNER_MAX_VALUES 8
+
+/*
+ * The tuner is an opaque data structure
+ */
+struct swarm_tuner;
+
+/*
+ * Log a decision made by the tuner.
+ */
+typedef void (*swarm_tuner_log_func)(const char *message, gpointer data);
+
+/*
+ * Create a tuner which retunes when the tick time drifts by more than the
+ * given fraction of the tuned time. The log function may be NULL.
+ */
+struct swarm_tuner *swarm_tuner_new(float threshold, swarm_tuner_log_func log,
+				    gpointer data);
+
+void swarm_tuner_free(struct swarm_tuner *tuner);
+
+/*
+ * Add a parameter with up to SWARM_TUNER_MAX_VALUES candidate values, and
+ * return it's index. Repeated values are ignored, and the parameter starts at
+ * the first value. Parameters with a single value are never timed. The name
+ * is used for logging, and must outlive the tuner. Every parameter must be
+ * added before the first tick is reported.
+ */
+int swarm_tuner_add_parameter(struct swarm_tuner *tuner, const char *name,
+			      const float *values, int count);
+
+/*
+ * Time every candidate over at least the given number of ticks, which should
+ * be the longest period of any work that a candidate does every so many ticks.
+ * The window is limited to 200 ticks. This must be called before the first
+ * tick is reported.
+ */
+void swarm_tuner_set_period(struct swarm_tuner *tuner, int ticks);
+
+/*
+ * Return the value of a parameter to use for the next tick.
+ */
+float swarm_tuner_get_value(struct swarm_tuner *tuner, int parameter);
+
+/*
+ * Report the time (in seconds) taken by a tick with the current values.
+ * Returns TRUE if any value has changed for the next tick.
+ */
+gboolean swarm_tuner_report(struct swarm_tuner *tuner, double tick_time);
+
+#endif /* _SWARM_TUNER_H_ */
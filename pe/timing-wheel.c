@@ -0,0 +1,136 @@
+#include "timing-wheel.h"
+
+#include <math.h>
+
+struct timing_wheel *timing_wheel_new(int item_count, int slot_count,
+				      double resolution)
+{
+	struct timing_wheel *wheel = g_slice_new0(struct timing_wheel);
+	int i;
+
+	wheel->resolution = resolution;
+	wheel->inv_resolution = 1.0 / resolution;
+
+	wheel->slot_count = slot_count;
+	wheel->slot_head = g_new(int, slot_count);
+	for (i = 0; i < slot_count; i++)
+		wheel->slot_head[i] = -1;
+
+	wheel->item_count = item_count;
+	wheel->times = g_new0(double, MAX(item_count, 1));
+	wheel->slot = g_new(int, MAX(item_count, 1));
+	wheel->next = g_new(int, MAX(item_count, 1));
+	wheel->prev = g_new(int, MAX(item_count, 1));
+
+	for (i = 0; i < item_count; i++)
+		wheel->slot[i] = -1;
+
+	return wheel;
+}
+
+void timing_wheel_free(struct timing_wheel *wheel)
+{
+	g_free(wheel->slot_head);
+	g_free(wheel->times);
+	g_free(wheel->slot);
+	g_free(wheel->next);
+	g_free(wheel->prev);
+
+	g_slice_free(struct timing_wheel, wheel);
+}
+
+static void unlink_item(struct timing_wheel *wheel, int item)
+{
+	int next = wheel->next[item], prev = wheel->prev[item];
+
+	if (prev >= 0)
+		wheel->next[prev] = next;
+	else
+		wheel->slot_head[wheel->slot[item]] = next;
+
+	if (next >= 0)
+		wheel->prev[next] = prev;
+
+	wheel->slot[item] = -1;
+}
+
+void timing_wheel_insert(struct timing_wheel *wheel, int item, double time)
+{
+	gint64 number = (gint64)floor(time * wheel->inv_resolution);
+	int slot;
+
+	if (wheel->slot[item] >= 0)
+		unlink_item(wheel, item);
+
+	/* Items which are already due go in the slot which is expired
+	 * next. */
+	number = MAX(number, wheel->current);
+	slot = number % wheel->slot_count;
+
+	wheel->times[item] = time;
+	wheel->slot[item] = slot;
+	wheel->prev[item] = -1;
+	wheel->next[item] = wheel->slot_head[slot];
+
+	if (wheel->slot_head[slot] >= 0)
+		wheel->prev[wheel->slot_head[slot]] = item;
+
+	wheel->slot_head[slot] = item;
+}
+
+void timing_wheel_remove(struct timing_wheel *wheel, int item)
+{
+	if (wheel->slot[item] >= 0)
+		unlink_item(wheel, item);
+}
+
+void timing_wheel_move(struct timing_wheel *wheel, int from, int to)
+{
+	int next = wheel->next[from], prev = wheel->prev[from];
+
+	wheel->times[to] = wheel->times[from];
+	wheel->slot[to] = wheel->slot[from];
+	wheel->next[to] = next;
+	wheel->prev[to] = prev;
+
+	if (prev >= 0)
+		wheel->next[prev] = to;
+	else
+		wheel->slot_head[wheel->slot[to]] = to;
+
+	if (next >= 0)
+		wheel->prev[next] = to;
+
+	wheel->slot[from] = -1;
+}
+
+int timing_wheel_expire(struct timing_wheel *wheel, double time, int *expired)
+{
+	gint64 number = (gint64)floor(time * wheel->inv_resolution);
+	gint64 last = MIN(number, wheel->current + wheel->slot_count - 1);
+	int item, next, count = 0;
+
+	if (number < wheel->current)
+		return 0;
+
+	/* The current slot may still hold items which expire later within
+	 * it, so it is visited again each time, until time moves past it. A
+	 * whole turn visits every slot, so there is no need to go around
+	 * more than once. */
+	for ( ; wheel->current <= last; wheel->current++) {
+		item = wheel->slot_head[wheel->current % wheel->slot_count];
+
+		for ( ; item >= 0; item = next) {
+			next = wheel->next[item];
+
+			if (wheel->times[item] <= time) {
+				unlink_item(wheel, item);
+				expired[count++] = item;
+			}
+		}
+	}
+
+	wheel->current = number;
+
+	return count;
+}
@@ -0,0 +1,81 @@
+/*
+ *         timing-wheel.h -- Expiry times bucketed by when they fall due.
+ *
+ * A timing wheel finds the items whose expiry time has passed without testing
+ * every item. Time is divided into slots of a fixed resolution, and the slots
+ * are arranged in a ring, so that each slot holds the items which expire
+ * within it's interval, on this or a later turn of the wheel. Expiring items
+ * only visits the slots that time has moved through since the last expiry, and
+ * the items within them, so the cost is proportional to the number of items
+ * expired rather than the number held.
+ *
+ * Items which expire more than a full turn of the wheel ahead share slots with
+ * nearer items, and are passed over until their turn comes around, so the
+ * wheel should span the usual lifetime of an item.
+ *
+ * Each slot keeps a linked list of it's items, indexed by item, so that items
+ * can be removed, or renumbered when their owner moves them, in constant time.
+ */
+#ifndef _TIMING_WHEEL_H_
+#define _TIMING_WHEEL_H_
+
+#include <glib.h>
+
+struct timing_wheel {
+	/* The interval covered by each slot, and it's reciprocal. */
+	double resolution;
+	double inv_resolution;
+
+	/* The first item in each slot, or -1 if empty. */
+	int *slot_head;
+	int slot_count;
+
+	/* The number of items that the wheel can hold. */
+	int item_count;
+
+	/* The number of the slot that was last expired, counted from time
+	 * zero. Slots before it have been emptied of expired items. */
+	gint64 current;
+
+	/* The expiry time and slot of each item, or -1 if the item is not in
+	 * the wheel, and the next and previous items in the same slot. */
+	double *times;
+	int *slot;
+	int *next;
+	int *prev;
+};
+
+/*
+ * Create an empty wheel for items with indices in the range [0, item_count),
+ * with slot_count slots of the given resolution (in seconds).
+ */
+struct timing_wheel *timing_wheel_new(int item_count, int slot_count,
+				      double resolution);
+
+void timing_wheel_free(struct timing_wheel *wheel);
+
+/*
+ * Add an item which expires at the given time. Items whose time has already
+ * passed are expired by the next call to timing_wheel_expire().
+ */
+void timing_wheel_insert(struct timing_wheel *wheel, int item, double time);
+
+/*
+ * Remove an item from the wheel, if it is in it.
+ */
+void timing_wheel_remove(struct timing_wheel *wheel, int item);
+
+/*
+ * Renumber an item which is in the wheel from the index from to the index to,
+ * which must not be in the wheel.
+ */
+void timing_wheel_move(struct timing_wheel *wheel, int from, int to);
+
+/*
+ * Remove every item whose expiry time is at or before time, write their
+ * indices to expired (which must have room for every item in the wheel), and
+ * return the number written. The items are in no particular order.
+ */
+int timing_wheel_expire(struct timing_wheel *wheel, double time, int *expired);
+
+#endif /* _TIMING_WHEEL_H_ */
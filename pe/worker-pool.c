@@ -0,0 +1,189 @@
+#include "worker-pool.h"
+
+/* The number of chunks that the range of a loop is split into per worker.
+ * More chunks balance the load better, at the cost of more contention. */
+#define CHUNKS_PER_WORKER 8
+
+/* The smallest chunk that is worth handing to a worker. */
+#define MIN_CHUNK_SIZE 64
+
+struct worker {
+	struct worker_pool *pool;
+	GThread *thread;
+	int index;
+};
+
+struct worker_pool {
+	struct worker *workers;
+	int worker_count;
+
+	GMutex mutex;
+
+	/* Signalled when a new loop is started, or the pool is stopped. */
+	GCond start_cond;
+
+	/* Signalled when the last worker finishes a loop. */
+	GCond done_cond;
+
+	/* Incremented for every loop, so that workers can tell when there is
+	 * new work to do. */
+	guint generation;
+
+	/* The number of worker threads that have not yet finished the current
+	 * loop. */
+	int pending;
+
+	gboolean quit;
+
+	/* The current loop. */
+	worker_pool_func func;
+	gpointer data;
+	int count;
+	int chunk_size;
+
+	/* The start of the next chunk to be processed. */
+	gint next;
+};
+
+static void run_chunks(struct worker_pool *pool, int worker)
+{
+	int start;
+
+	while ((start = g_atomic_int_add(&pool->next, pool->chunk_size)) <
+	       pool->count) {
+		pool->func(pool->data, start,
+			   MIN(start + pool->chunk_size, pool->count), worker);
+	}
+}
+
+static gpointer worker_main(gpointer data)
+{
+	struct worker *worker = data;
+	struct worker_pool *pool = worker->pool;
+	guint generation = 0;
+
+	g_mutex_lock(&pool->mutex);
+
+	while (TRUE) {
+		while (pool->generation == generation && !pool->quit)
+			g_cond_wait(&pool->start_cond, &pool->mutex);
+
+		if (pool->quit)
+			break;
+
+		generation = pool->generation;
+		g_mutex_unlock(&pool->mutex);
+
+		run_chunks(pool, worker->index);
+
+		g_mutex_lock(&pool->mutex);
+		if (--pool->pending == 0)
+			g_cond_signal(&pool->done_cond);
+	}
+
+	g_mutex_unlock(&pool->mutex);
+
+	return NULL;
+}
+
+struct worker_pool *worker_pool_new(int worker_count)
+{
+	struct worker_pool *pool = g_slice_new0(struct worker_pool);
+	int i;
+
+	if (worker_count < 1)
+		worker_count = g_get_num_processors();
+
+	pool->worker_count = worker_count;
+	pool->workers = g_new0(struct worker, worker_count);
+
+	g_mutex_init(&pool->mutex);
+	g_cond_init(&pool->start_cond);
+	g_cond_init(&pool->done_cond);
+
+	/* Worker 0 is the calling thread, so doesn't need a thread of it's
+	 * own. */
+	for (i = 0; i < worker_count; i++) {
+		struct worker *worker = &pool->workers[i];
+
+		worker->pool = pool;
+		worker->index = i;
+
+		if (i > 0)
+			worker->thread = g_thread_new("pe-worker", worker_main,
+						      worker);
+	}
+
+	return pool;
+}
+
+void worker_pool_free(struct worker_pool *pool)
+{
+	int i;
+
+	g_mutex_lock(&pool->mutex);
+	pool->quit = TRUE;
+	g_cond_broadcast(&pool->start_cond);
+	g_mutex_unlock(&pool->mutex);
+
+	for (i = 1; i < pool->worker_count; i++)
+		g_thread_join(pool->workers[i].thread);
+
+	g_mutex_clear(&pool->mutex);
+	g_cond_clear(&pool->start_cond);
+	g_cond_clear(&pool->done_cond);
+
+	g_free(pool->workers);
+	g_slice_free(struct worker_pool, pool);
+}
+
+int worker_pool_get_worker_count(struct worker_pool *pool)
+{
+	return pool->worker_count;
+}
+
+void worker_pool_run(struct worker_pool *pool, int count,
+		     worker_pool_func func, gpointer data)
+{
+	worker_pool_run_chunks(pool, count,
+			       MAX(count / (pool->worker_count * CHUNKS_PER_WORKER),
+				   MIN_CHUNK_SIZE),
+			       func, data);
+}
+
+void worker_pool_run_chunks(struct worker_pool *pool, int count,
+			    int chunk_size, worker_pool_func func,
+			    gpointer data)
+{
+	if (count <= 0)
+		return;
+
+	chunk_size = MAX(chunk_size, 1);
+
+	/* Small loops aren't worth waking the workers for. */
+	if (pool->worker_count == 1 || count <= chunk_size) {
+		func(data, 0, count, 0);
+		return;
+	}
+
+	g_mutex_lock(&pool->mutex);
+
+	pool->func = func;
+	pool->data = data;
+	pool->count = count;
+	pool->chunk_size = chunk_size;
+	pool->next = 0;
+	pool->pending = pool->worker_count - 1;
+	pool->generation++;
+
+	g_cond_broadcast(&pool->start_cond);
+	g_mutex_unlock(&pool->mutex);
+
+	/* Lend a hand */
+	run_chunks(pool, 0);
+
+	g_mutex_lock(&pool->mutex);
+	while (pool->pending > 0)
+		g_cond_wait(&pool->done_cond, &pool->mutex);
+	g_mutex_unlock(&pool->mutex);
+}
@@ -0,0 +1,64 @@
+/*
+ *         worker-pool.h -- A pool of threads for data parallel loops.
+ *
+ * A worker pool splits the range of a loop [0, count) into chunks, which are
+ * processed concurrently by a fixed set of worker threads. The calling thread
+ * also takes part, so a pool of N workers owns N - 1 threads, and a pool with
+ * a single worker runs every loop serially on the calling thread.
+ *
+ * Chunks are handed out dynamically, so workers which finish early will take
+ * on more of the range. This matters for particles, where the cost of each
+ * particle depends on how crowded it's neighbourhood is.
+ */
+#ifndef _WORKER_POOL_H_
+#define _WORKER_POOL_H_
+
+#include <glib.h>
+
+/*
+ * The worker pool is an opaque data structure
+ */
+struct worker_pool;
+
+/*
+ * Process the particles in the range [start, end). The worker argument is the
+ * index of the worker running the function, in the range [0, worker count),
+ * and can be used to select per-worker storage. The calling thread is always
+ * worker 0.
+ */
+typedef void (*worker_pool_func)(gpointer data, int start, int end,
+				 int worker);
+
+/*
+ * Create a new pool with the given number of workers. If worker_count is less
+ * than one, then the pool has one worker per processor.
+ */
+struct worker_pool *worker_pool_new(int worker_count);
+
+/*
+ * Stop the worker threads and free the pool.
+ */
+void worker_pool_free(struct worker_pool *pool);
+
+/*
+ * Return the number of workers in the pool, including the calling thread.
+ */
+int worker_pool_get_worker_count(struct worker_pool *pool);
+
+/*
+ * Run func over the range [0, count), blocking until every chunk has been
+ * processed. This must only be called from one thread at a time.
+ */
+void worker_pool_run(struct worker_pool *pool, int count,
+		     worker_pool_func func, gpointer data);
+
+/*
+ * The same as worker_pool_run(), but with chunks of the given size, for loops
+ * where each item is expensive enough to be worth handing out alone. Loops
+ * which fit in a single chunk are run serially on the calling thread.
+ */
+void worker_pool_run_chunks(struct worker_pool *pool, int count,
+			    int chunk_size, worker_pool_func func,
+			    gpointer data);
+
+#endif /* _WORKER_POOL_H_ */